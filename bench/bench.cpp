@@ -0,0 +1,164 @@
+#include "SDL2_core.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace SDL2_Core;
+
+// Every benchmark runs a warm-up pass and then a fixed number of timed
+// repetitions. The median repetition is reported as one JSON object per
+// line, so runs can be diffed and collected by scripts.
+
+static constexpr int repetitions = 7;
+
+static void report(const std::string& name, size_t n, size_t ops, double median_ms) {
+	double ns_per_op = median_ms * 1e6 / static_cast<double>(ops);
+	std::printf(
+		"{\"name\": \"%s\", \"n\": %zu, \"ms\": %.4f, \"ns_per_op\": %.2f}\n",
+		name.c_str(), n, median_ms, ns_per_op
+	);
+	std::fflush(stdout);
+}
+
+static void bench(
+	const std::string& name, size_t n, size_t ops, const std::function<void()>& run)
+{
+	run();
+	std::vector<double> times;
+	for (int i = 0; i < repetitions; i++) {
+		auto start = std::chrono::steady_clock::now();
+		run();
+		auto end = std::chrono::steady_clock::now();
+		times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+	}
+	std::sort(times.begin(), times.end());
+	report(name, n, ops, times[times.size() / 2]);
+}
+
+int main(void) {
+	try {
+	Sdl::Config config;
+	config.init_flags = SDL_INIT_VIDEO;
+	config.window_flags = SDL_WINDOW_HIDDEN;
+	config.renderer_flags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE;
+	Sdl sdl("bench", 800, 600, config);
+
+	const std::string bmp = "../assets/face.bmp";
+	const std::string font = "../MononokiNerdFont-Regular.ttf";
+
+	bench("load_texture", 1, 100, [&]() {
+		for (int i = 0; i < 100; i++)
+			sdl.unload_texture(sdl.load_texture(bmp));
+	});
+
+	bench("load_text", 1, 100, [&]() {
+		for (int i = 0; i < 100; i++) {
+			auto text = sdl.load_text(
+				"text " + std::to_string(i), {255, 255, 255, 255}, {0, 0}, font, 24
+			);
+			sdl.unload_texture(text.id);
+		}
+	});
+
+	auto sprite = sdl.load_texture(bmp);
+	std::vector<std::string> names;
+	for (int i = 0; i < 1000; i++)
+		names.push_back("../assets/sprite_" + std::to_string(i) + ".bmp");
+	bench("find_texture", names.size(), 100000, [&]() {
+		size_t found = 0;
+		for (int i = 0; i < 100000; i++)
+			found += sdl.find_texture(i % 2 ? bmp : names[static_cast<size_t>(i) % names.size()]).has_value();
+		if (found == 0) std::cerr << "find_texture found nothing\n";
+	});
+
+	for (size_t count : {size_t{1000}, size_t{10000}, size_t{100000}}) {
+		std::vector<Sdl::RenderData> sprites(count);
+		for (size_t i = 0; i < count; i++) {
+			int x = static_cast<int>(i * 7 % 780);
+			int y = static_cast<int>(i * 13 % 580);
+			sprites[i].dstrect = SDL_Rect{x, y, 20, 20};
+			sprites[i].col_or_tex = sprite;
+		}
+
+		bench("draw_single", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			for (const auto& data : sprites)
+				sdl.draw(data);
+			sdl.present();
+		});
+
+		bench("draw_vector", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			sdl.draw(sprites);
+			sdl.present();
+		});
+
+		std::vector<Sdl::CommandBuffer> lists(4);
+		for (size_t i = 0; i < count; i++)
+			lists[i * lists.size() / count].draw(sprites[i]);
+		bench("submit_lists", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			sdl.submit({&lists[0], &lists[1], &lists[2], &lists[3]});
+			sdl.present();
+		});
+
+		Sdl::Instances instances;
+		for (const auto& data : sprites)
+			instances.push(
+				{static_cast<float>(data.dstrect->x), static_cast<float>(data.dstrect->y)},
+				{20.0f, 20.0f}
+			);
+		bench("draw_instanced", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			sdl.draw_instanced(sprite, instances);
+			sdl.present();
+		});
+
+		// A square world of 32 pixel tiles seen through a scrolling view,
+		// against drawing the whole world with culling.
+		const int side = static_cast<int>(std::sqrt(static_cast<double>(count)));
+		std::vector<Sdl::RenderData> world;
+		Sdl::StaticBatch tiles(256);
+		for (int y = 0; y < side; y++)
+			for (int x = 0; x < side; x++) {
+				Sdl::RenderData tile;
+				tile.dstrect = SDL_Rect{x * 32, y * 32, 32, 32};
+				tile.col_or_tex = sprite;
+				world.push_back(tile);
+				tiles.add(tile);
+			}
+		int frame = 0;
+		bench("static_batch", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			int offset = (frame++ * 16) % std::max(1, side * 32 - 800);
+			sdl.draw(tiles, {offset, offset / 2, 800, 600});
+			sdl.present();
+		});
+
+		sdl.set_culling(true);
+		bench("draw_vector_culled", count, count, [&]() {
+			sdl.clear({0, 0, 0, 255});
+			sdl.draw(world);
+			sdl.present();
+		});
+		sdl.set_culling(false);
+	}
+
+	bench("present", 1, 100, [&]() {
+		for (int i = 0; i < 100; i++) {
+			sdl.clear({0, 0, 0, 255});
+			sdl.present();
+		}
+	});
+
+	} catch (const std::runtime_error& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -28,17 +28,49 @@ SOFTWARE.
 #ifndef SDL2_CORE_HPP
 #define SDL2_CORE_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <new>
 #include <optional>
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 // Debug messages are only printed when NDEBUG and TEST are not defined.
 // When TEST is defined, debug messages are saved in a thread local 
@@ -57,15 +89,716 @@ SOFTWARE.
 #define DBGMSG(msg)
 #endif
 
+// Draw statistics are collected unless SDL2_CORE_NO_STATS is defined,
+// in which case the counters and timers compile to nothing.
+
+#ifndef SDL2_CORE_NO_STATS
+#define SDL2_CORE_STATS(expr) expr
+#else
+#define SDL2_CORE_STATS(expr)
+#endif
+
+// Errors are thrown as std::runtime_error unless SDL2_CORE_NO_EXCEPTIONS
+// is defined, in which case they are logged and the program aborts. The
+// try_ functions report their errors without either.
+
+#ifndef SDL2_CORE_NO_EXCEPTIONS
+#define SDL2_CORE_THROW(msg)\
+	throw std::runtime_error(msg)
+#else
+#define SDL2_CORE_THROW(msg)\
+	::SDL2_Core::fatal_error(msg)
+#endif
+
 namespace SDL2_Core {
 
 #ifdef TEST
 	inline thread_local std::string dbg_msg;
+	// Makes the software rasterizer's next renderer flush fail, an error
+	// SDL can't be made to produce on demand.
+	inline thread_local bool fail_next_flush {false};
+#endif
+
+#ifdef SDL2_CORE_NO_EXCEPTIONS
+	[[noreturn]] inline void fatal_error(const char* msg) {
+		SDL_LogCritical(SDL_LOG_CATEGORY_APPLICATION, "%s", msg);
+		std::abort();
+	}
 #endif
 
 /** Class to manage SDL2 resources and behaviour. */
 class Sdl {
 
+public:
+
+	// Structs and enums
+
+	/** Handle to a texture stored by an Sdl object.
+	 * The index addresses a slot of the texture array, the generation
+	 * tells whether the slot still holds the texture the handle was
+	 * created for. A default constructed handle is never valid. */
+	struct TextureId {
+		Uint32 index {0};
+		Uint32 generation {0};
+
+		bool operator==(const TextureId& other) const {
+			return index == other.index && generation == other.generation;
+		}
+
+		bool operator!=(const TextureId& other) const {
+			return !(*this == other);
+		}
+	};
+
+	/** The state of a texture loaded with load_texture_async. */
+	enum class LoadStatus {
+
+		/** The bmp is still being decoded or waiting to be uploaded.
+		 * The texture draws as a placeholder meanwhile. */
+		Loading,
+
+		/** The texture is ready. */
+		Ready,
+
+		/** The bmp could not be loaded. The placeholder stays in use. */
+		Failed
+	};
+
+	/** The errors returned by the try_ functions. */
+	enum class Error {
+
+		/** The call succeeded. */
+		None,
+
+		/** A texture handle didn't refer to a loaded texture. Nothing
+		 * was drawn. */
+		InvalidHandle,
+
+		/** A texture was evicted to keep within the texture budget.
+		 * Nothing was drawn. Drawing it with draw reloads it. */
+		Evicted,
+
+		/** An SDL call failed, SDL_GetError tells why. The draws that
+		 * didn't depend on it were still made. */
+		RenderFailed
+	};
+
+	/** Handle to a font opened by an Sdl object.
+	 * Works the same way as TextureId. */
+	struct FontId {
+		Uint32 index {0};
+		Uint32 generation {0};
+
+		bool operator==(const FontId& other) const {
+			return index == other.index && generation == other.generation;
+		}
+
+		bool operator!=(const FontId& other) const {
+			return !(*this == other);
+		}
+	};
+
+	/** Struct to group data to be passed to the draw functions. */
+	struct RenderData {
+
+		/** The portion of the texture to be rendered.
+		 * If nullopt, the whole texture gets rendered. */
+		std::optional<SDL_Rect> srcrect {std::nullopt};
+
+		/** The target rect to render the texture over or fill with color.
+		 * If nullopt, the whole rendering target gets filled. */
+		std::optional<SDL_Rect> dstrect {std::nullopt};
+
+		/** Like dstrect, with subpixel precision. Takes precedence over
+		 * dstrect when set. */
+		std::optional<SDL_FRect> fdstrect {std::nullopt};
+
+		/** Variable to hold either a color or the handle of the texture to be used. */
+		std::variant<SDL_Color, TextureId> col_or_tex {SDL_Color{255, 0, 0, 255}};
+
+		/** The angle by which the texture should be rotated. */
+		float angle {0.0f};
+
+		/** The texture's flip state. */
+		SDL_RendererFlip flip {SDL_FLIP_NONE};
+
+		/** The layer to draw on. Only used by command buffers with sorting
+		 * enabled, where lower layers are drawn first. */
+		Uint16 layer {0};
+	};
+
+	static_assert(
+		std::is_trivially_copyable_v<RenderData>,
+		"RenderData must stay cheap to pass around and store in bulk."
+	);
+
+	/** Struct returned by load_text. */
+	struct LoadedText {
+
+		/** The handle of the texture holding the rendered text. */
+		TextureId id;
+
+		/** A rect appropriately sized to fit the text. */
+		SDL_Rect rect;
+	};
+
+	/** Per-instance data for draw_instanced, stored as one array per
+	 * attribute. The arrays of an attribute that is left empty take its
+	 * default for every instance; the others must all be the same size. */
+	struct Instances {
+
+		/** The horizontal positions of the centers. */
+		std::vector<float> x;
+
+		/** The vertical positions of the centers. */
+		std::vector<float> y;
+
+		/** The widths. */
+		std::vector<float> w;
+
+		/** The heights. */
+		std::vector<float> h;
+
+		/** The angles in degrees, clockwise. Defaults to 0. */
+		std::vector<float> angle;
+
+		/** The colors the texture is multiplied with. Defaults to white. */
+		std::vector<SDL_Color> color;
+
+		/** @return The number of instances. */
+		size_t size() const {
+			return x.size();
+		}
+
+		/** Appends an instance. Attributes left empty so far stay empty
+		 * if the given value is their default.
+		 * @param pos The center of the instance.
+		 * @param size The width and the height of the instance.
+		 * @param rot The angle in degrees.
+		 * @param col The color to multiply the texture with. */
+		void push(SDL_FPoint pos, SDL_FPoint size, float rot = 0.0f, SDL_Color col = {255, 255, 255, 255}) {
+			if (rot != 0.0f && angle.empty()) angle.resize(x.size(), 0.0f);
+			bool white = col.r == 255 && col.g == 255 && col.b == 255 && col.a == 255;
+			if (!white && color.empty()) color.resize(x.size(), {255, 255, 255, 255});
+			x.push_back(pos.x);
+			y.push_back(pos.y);
+			w.push_back(size.x);
+			h.push_back(size.y);
+			if (!angle.empty()) angle.push_back(rot);
+			if (!color.empty()) color.push_back(col);
+		}
+
+		/** Removes every instance. The memory is kept for reuse. */
+		void clear() {
+			x.clear();
+			y.clear();
+			w.clear();
+			h.clear();
+			angle.clear();
+			color.clear();
+		}
+	};
+
+	/** A 2D affine transform, mapping the point (x, y) to
+	 * (a * x + c * y + tx, b * x + d * y + ty). */
+	struct Transform {
+		float a {1.0f};
+		float b {0.0f};
+		float c {0.0f};
+		float d {1.0f};
+		float tx {0.0f};
+		float ty {0.0f};
+
+		/** @param p The point to be transformed.
+		 * @return The transformed point. */
+		SDL_FPoint apply(SDL_FPoint p) const {
+			return {a * p.x + c * p.y + tx, b * p.x + d * p.y + ty};
+		}
+
+		/** @return True if the transform leaves every point in place. */
+		bool identity() const {
+			return a == 1.0f && b == 0.0f && c == 0.0f && d == 1.0f && tx == 0.0f && ty == 0.0f;
+		}
+	};
+
+	/** Struct returned by lock_texture. */
+	struct LockedPixels {
+
+		/** The mapped pixels of the locked area. Write only; the previous
+		 * contents are undefined. */
+		void* pixels;
+
+		/** The length of a row of pixels in bytes. */
+		int pitch;
+
+		/** The width of the locked area. */
+		int w;
+
+		/** The height of the locked area. */
+		int h;
+	};
+
+	/** Options for creating an Sdl object. The defaults reproduce the
+	 * behaviour of the three argument constructor. */
+	struct Config {
+
+		/** The SDL subsystems to initialize. SDL_INIT_VIDEO is enough
+		 * for drawing; the rest only adds startup time. */
+		Uint32 init_flags {SDL_INIT_EVERYTHING};
+
+		/** The flags the window is created with. Use SDL_WINDOW_HIDDEN
+		 * for headless tools. */
+		Uint32 window_flags {SDL_WINDOW_SHOWN};
+
+		/** The position of the window. */
+		SDL_Point window_pos {0, 0};
+
+		/** The flags the renderer is created with. Drop
+		 * SDL_RENDERER_PRESENTVSYNC to run uncapped and add
+		 * SDL_RENDERER_TARGETTEXTURE to render to textures. */
+		Uint32 renderer_flags {SDL_RENDERER_PRESENTVSYNC};
+
+		/** The render driver to use, like "opengl", "vulkan", "metal" or
+		 * "direct3d11". If empty, SDL picks one. */
+		std::string driver;
+
+		/** Whether SDL may batch render calls internally. */
+		bool render_batching {true};
+
+		/** Renders into a memory surface instead of a window, for
+		 * headless runs like golden image tests. Batched draws are
+		 * rasterized by the library's own multi-threaded rasterizer and
+		 * everything else goes through SDL's software renderer. The
+		 * result can be read with Sdl::framebuffer after present. No
+		 * window is created, so init_flags can be 0. */
+		bool software_renderer {false};
+	};
+
+	/** Counters and timings of a frame, see Sdl::stats. */
+	struct Stats {
+
+		/** The number of SDL render calls that drew something. */
+		Uint64 draw_calls {0};
+
+		/** The number of times a texture was bound for drawing. */
+		Uint64 textures_bound {0};
+
+		/** The number of quads submitted. */
+		Uint64 quads {0};
+
+		/** The number of batches flushed early because the texture changed. */
+		Uint64 batch_breaks {0};
+
+		/** The number of draws skipped by culling, see Sdl::set_culling. */
+		Uint64 culled {0};
+
+		/** The number of draw color, blend mode, render target and texture
+		 * mod changes passed on to SDL. Setting a state to the value it
+		 * already has isn't counted, since SDL isn't called. */
+		Uint64 state_changes {0};
+
+		/** CPU time spent in the draw functions and submit, in milliseconds. */
+		double draw_ms {0.0};
+
+		/** CPU time spent in present, in milliseconds. */
+		double present_ms {0.0};
+
+		/** Time present waited for the frame to be due, in milliseconds,
+		 * see Sdl::set_frame_rate. */
+		double wait_ms {0.0};
+
+		/** The frame rate present was pacing to, lowered while adaptive
+		 * pacing has reduced it. 0 without pacing. */
+		double frame_rate {0.0};
+
+		/** Time from the first Sdl::mark_input call of the frame until it
+		 * was presented, in milliseconds. 0 if there was none. */
+		double input_latency_ms {0.0};
+	};
+
+	/** Records draw commands to be submitted later by an Sdl object.
+	 * Commands, and the text they refer to, are stored in a linear arena
+	 * that is reset instead of freed between frames, so recording stops
+	 * allocating once the arena has grown to the size of a typical frame.
+	 * A command buffer doesn't touch SDL, so it can be filled on any
+	 * thread. */
+	class CommandBuffer {
+		friend class Sdl;
+
+		enum class Type : Uint8 {
+			Draw,
+			Text
+		};
+
+		struct Command {
+			Type type;
+			Command* next;
+		};
+
+		struct DrawCommand : Command {
+			RenderData data;
+		};
+
+		struct TextCommand : Command {
+			Uint16 layer;
+			FontId font;
+			SDL_Point pos;
+			SDL_Color col;
+			const char* text;
+			size_t length;
+		};
+
+		/** Bump allocator over a list of blocks that are kept on reset. */
+		class Arena {
+			struct Block {
+				std::unique_ptr<unsigned char[]> data;
+				size_t size;
+			};
+			static constexpr size_t block_size = 64 * 1024;
+			std::vector<Block> blocks;
+			size_t current {0};
+			size_t offset {0};
+
+		public:
+
+			void* allocate(size_t size, size_t align) {
+				for (; current < blocks.size(); current++, offset = 0) {
+					size_t start = (offset + align - 1) & ~(align - 1);
+					if (start + size <= blocks[current].size) {
+						offset = start + size;
+						return blocks[current].data.get() + start;
+					}
+				}
+				size_t bytes = std::max(block_size, size);
+				blocks.push_back({std::unique_ptr<unsigned char[]>(new unsigned char[bytes]), bytes});
+				current = blocks.size() - 1;
+				offset = size;
+				return blocks[current].data.get();
+			}
+
+			void reset() {
+				current = 0;
+				offset = 0;
+			}
+		};
+
+		Arena arena;
+		Command* head {nullptr};
+		Command* tail {nullptr};
+		size_t count {0};
+		bool sorting {false};
+
+		template <typename T>
+		T* push(Type type) {
+			static_assert(std::is_trivially_destructible_v<T>);
+			T* cmd = new (arena.allocate(sizeof(T), alignof(T))) T();
+			cmd->type = type;
+			cmd->next = nullptr;
+			if (tail) tail->next = cmd;
+			else head = cmd;
+			tail = cmd;
+			count++;
+			return cmd;
+		}
+
+	public:
+
+		/** Records a draw.
+		 * @param data The renderer data to be used. */
+		void draw(const RenderData& data) {
+			push<DrawCommand>(Type::Draw)->data = data;
+		}
+
+		/** Records a draw for every element of an array.
+		 * @param data Pointer to the first element of the array.
+		 * @param count The number of elements. */
+		void draw(const RenderData* data, size_t count) {
+			for (size_t i = 0; i < count; i++)
+				draw(data[i]);
+		}
+
+		/** Records a draw for every element of a vector.
+		 * @param data The vector of renderer data to be used. */
+		void draw(const std::vector<RenderData>& data) {
+			draw(data.data(), data.size());
+		}
+
+		/** Records text to be drawn like Sdl::draw_text does.
+		 * The text is copied into the buffer.
+		 * @param text The UTF-8 text to be drawn.
+		 * @param pos The position of the top left corner of the text.
+		 * @param col The color of the text.
+		 * @param font The handle of the font to be used.
+		 * @param layer The layer to draw on when sorting is enabled. */
+		void draw_text(
+			std::string_view text, SDL_Point pos, SDL_Color col, FontId font,
+			Uint16 layer = 0)
+		{
+			char* copy = static_cast<char*>(arena.allocate(text.size(), 1));
+			if (!text.empty())
+				std::memcpy(copy, text.data(), text.size());
+			auto cmd = push<TextCommand>(Type::Text);
+			cmd->layer = layer;
+			cmd->font = font;
+			cmd->pos = pos;
+			cmd->col = col;
+			cmd->text = copy;
+			cmd->length = text.size();
+		}
+
+		/** @return The number of recorded commands. */
+		size_t size() const {
+			return count;
+		}
+
+		/** @return True if no commands are recorded. */
+		bool empty() const {
+			return count == 0;
+		}
+
+		/** Enables or disables sorting on submission. When enabled,
+		 * commands are drawn ordered by layer, then by texture and blend
+		 * mode, so draws sharing a texture batch together no matter the
+		 * order they were recorded in. The order of draws within a layer
+		 * is only kept among draws of the same texture.
+		 * @param enabled True to sort. */
+		void set_sorting(bool enabled) {
+			sorting = enabled;
+		}
+
+		/** Drops every recorded command. The memory is kept for reuse. */
+		void reset() {
+			arena.reset();
+			head = nullptr;
+			tail = nullptr;
+			count = 0;
+		}
+	};
+
+	/** Hands command buffers from a simulation thread to the render
+	 * thread, the one that created the Sdl object and is the only one
+	 * using it. The producer records into back() and publishes it at
+	 * the end of each frame, while the render thread submits the newest
+	 * published frame whenever it draws. Three buffers are rotated with
+	 * an atomic exchange, so neither side ever waits for the other. With
+	 * several producer threads, give each its own queue. */
+	class FrameQueue {
+		friend class Sdl;
+		static constexpr int fresh = 4;
+		std::array<CommandBuffer, 3> buffers;
+		int write_index {0};
+		int read_index {1};
+		std::atomic<int> ready {2};
+	public:
+
+		/** @return The buffer the producer records the next frame into. */
+		CommandBuffer& back() {
+			return buffers[static_cast<size_t>(write_index)];
+		}
+
+		/** Publishes the recorded frame and starts an empty one. A frame
+		 * published before the previous one was acquired replaces it.
+		 * The new frame keeps the sorting setting of the published one.
+		 * Only called by the producer. */
+		void publish() {
+			bool sorting = back().sorting;
+			write_index = ready.exchange(write_index | fresh) & 3;
+			back().reset();
+			back().sorting = sorting;
+		}
+
+		/** Takes the newest published frame. If nothing was published
+		 * since the last call, the frame taken then is returned again.
+		 * Only called by the render thread.
+		 * @return The frame, empty if nothing was published yet. */
+		const CommandBuffer& acquire() {
+			if (ready.load() & fresh)
+				read_index = ready.exchange(read_index) & 3;
+			return buffers[static_cast<size_t>(read_index)];
+		}
+	};
+
+	/** Holds draws that rarely change, like the tiles of a map, in a
+	 * uniform grid. Sdl::draw only visits the cells overlapping the view,
+	 * so a frame costs what is visible rather than what was added. The
+	 * vertices of a cell are built the first time it is drawn and reused
+	 * until something is added to it or one of its textures changes
+	 * size, like a placeholder replaced by the texture loaded
+	 * asynchronously or a texture hot reloaded at a new size. Draws
+	 * within a cell keep the order they were added in, while cells are
+	 * drawn row by row. */
+	class StaticBatch {
+		friend class Sdl;
+
+		// The region and size of a texture the UVs of a run were built
+		// with. A placeholder replaced by the loaded texture or a texture
+		// reloaded at a new size invalidates them.
+		struct Run {
+			TextureId id;
+			bool textured;
+			size_t quads;
+			SDL_Rect region;
+			int tex_w;
+			int tex_h;
+		};
+
+		struct Cell {
+			std::vector<RenderData> items;
+			std::vector<SDL_Vertex> vertices;
+			std::vector<Run> runs;
+			bool built {false};
+		};
+
+		int cell_size;
+		std::unordered_map<Uint64, Cell> cells;
+		size_t count {0};
+
+		// A draw is stored in the cell of the top left corner of its
+		// bounds, so the cells searched are widened by the largest bounds.
+		int max_w {0};
+		int max_h {0};
+
+		// The range of cells holding draws.
+		int min_cx {0};
+		int min_cy {0};
+		int max_cx {-1};
+		int max_cy {-1};
+
+		static Uint64 key(int cx, int cy) {
+			return (Uint64{static_cast<Uint32>(cx)} << 32) | static_cast<Uint32>(cy);
+		}
+
+		int cell_of(int v) const {
+			return v >= 0 ? v / cell_size : -((-v - 1) / cell_size) - 1;
+		}
+
+	public:
+
+		/** Creates an empty static batch.
+		 * @param cell_size The width and height of the grid cells. Around
+		 * the size of the view is a good start.
+		 * @throws std::runtime_error if the cell size isn't positive. */
+		explicit StaticBatch(int cell_size = 256) : cell_size(cell_size) {
+			if (cell_size <= 0)
+				SDL2_CORE_THROW("Invalid cell size.");
+		}
+
+		/** Adds a draw to the batch.
+		 * @param data The renderer data to be used. Its dstrect, or
+		 * fdstrect, is in the coordinates of the views the batch is drawn
+		 * with.
+		 * @throws std::runtime_error if data has no dstrect. */
+		void add(const RenderData& data) {
+			auto bounds = dst_bounds(data);
+			if (!bounds)
+				SDL2_CORE_THROW("Static batch draws need a dstrect.");
+			const SDL_Rect& r = *bounds;
+			int cx = cell_of(r.x), cy = cell_of(r.y);
+			Cell& cell = cells[key(cx, cy)];
+			cell.items.push_back(data);
+			cell.built = false;
+			max_w = std::max(max_w, r.w);
+			max_h = std::max(max_h, r.h);
+			if (count == 0) {
+				min_cx = max_cx = cx;
+				min_cy = max_cy = cy;
+			} else {
+				min_cx = std::min(min_cx, cx);
+				min_cy = std::min(min_cy, cy);
+				max_cx = std::max(max_cx, cx);
+				max_cy = std::max(max_cy, cy);
+			}
+			count++;
+		}
+
+		/** Adds a draw for every element of a vector.
+		 * @param data The vector of renderer data to be used.
+		 * @throws std::runtime_error if an element has no dstrect. */
+		void add(const std::vector<RenderData>& data) {
+			for (const auto& d : data)
+				add(d);
+		}
+
+		/** @return The number of draws in the batch. */
+		size_t size() const {
+			return count;
+		}
+
+		/** Removes every draw. */
+		void clear() {
+			cells.clear();
+			count = 0;
+			max_w = max_h = 0;
+			min_cx = min_cy = 0;
+			max_cx = max_cy = -1;
+		}
+	};
+
+	/** CPU side pixel buffers for handing frames from a producer thread
+	 * to the thread that owns the Sdl object. The producer fills the back
+	 * buffer and publishes it, which swaps it with the front buffer.
+	 * Sdl::update_texture takes the front buffer in exchange for a third
+	 * one and uploads it after letting go of the stream, so neither side
+	 * waits for the other and nothing is reallocated per frame. A frame
+	 * published before the previous one was uploaded replaces it. */
+	class PixelStream {
+		friend class Sdl;
+		int w;
+		int h;
+		int row_pitch;
+		std::vector<Uint8> back;
+		std::vector<Uint8> front;
+		std::vector<Uint8> upload;
+		std::mutex mutex;
+		bool ready {false};
+	public:
+
+		/** Constructor.
+		 * @param w The width of a frame.
+		 * @param h The height of a frame.
+		 * @param bytes_per_pixel The size of a pixel. It must match the
+		 * format of the textures the stream is uploaded to.
+		 * @throws std::runtime_error if the size is invalid. */
+		PixelStream(int w, int h, int bytes_per_pixel = 4) :
+			w(w), h(h), row_pitch(w * bytes_per_pixel)
+		{
+			if (w <= 0 || h <= 0 || bytes_per_pixel <= 0)
+				SDL2_CORE_THROW("Invalid pixel stream size.");
+			back.resize(static_cast<size_t>(row_pitch) * static_cast<size_t>(h));
+			front.resize(back.size());
+			upload.resize(back.size());
+		}
+
+		/** @return The back buffer to be filled by the producer. Its
+		 * contents are those of an older frame. */
+		Uint8* pixels() {
+			return back.data();
+		}
+
+		/** @return The length of a row of pixels in bytes. */
+		int pitch() const {
+			return row_pitch;
+		}
+
+		/** @return The width of a frame. */
+		int width() const {
+			return w;
+		}
+
+		/** @return The height of a frame. */
+		int height() const {
+			return h;
+		}
+
+		/** Makes the back buffer the next frame to be uploaded. The
+		 * pointer returned by pixels is invalidated. */
+		void publish() {
+			std::lock_guard lock(mutex);
+			std::swap(back, front);
+			ready = true;
+		}
+	};
+
 private:
 
 	// Custom types
@@ -79,9 +812,9 @@ private:
 		friend class Sdl;
 		Base(Uint32 flags) {
 			if (SDL_Init(flags))
-				throw std::runtime_error("Failed to initialize SDL2.");
+				SDL2_CORE_THROW("Failed to initialize SDL2.");
 			if (TTF_Init())
-				throw std::runtime_error("Failed to initialize TTF.");
+				SDL2_CORE_THROW("Failed to initialize TTF.");
 			DBGMSG("SDL2 and TTF initialized.");
 		}
 		~Base() {
@@ -91,68 +824,2482 @@ private:
 		}
 	};
 	
-	// Variables
+	/** Adds the time spent in its scope to a tick counter. */
+	class PhaseTimer {
+		friend class Sdl;
+		Uint64& ticks;
+		Uint64 start;
+		PhaseTimer(Uint64& t) : ticks(t), start(SDL_GetPerformanceCounter()) {}
+	public:
+		~PhaseTimer() {
+			ticks += SDL_GetPerformanceCounter() - start;
+		}
+	};
 
-	Base base;
-	Window win;
-	Renderer ren;
-	std::map<std::string, Texture> textures_map;
+	/** A ring buffer of timed zones that any thread can write to without
+	 * locking. Each record is guarded by a sequence number that is odd
+	 * while it is being written, so a reader skips records that are
+	 * torn or were overwritten while it read them. */
+	class Profiler {
+		friend class Sdl;
+		static constexpr size_t detail_words = 5;
+		struct Record {
+			std::atomic<Uint64> seq {0};
+			std::atomic<const char*> name {nullptr};
+			std::atomic<Uint64> start {0};
+			std::atomic<Uint64> end {0};
+			std::atomic<Uint64> frame {0};
+			std::atomic<Uint64> count {0};
+			std::atomic<Uint32> thread {0};
+			std::array<std::atomic<Uint64>, detail_words> detail {};
+		};
+		struct Zone {
+			const char* name;
+			Uint64 start;
+			Uint64 end;
+			Uint64 frame;
+			Uint64 count;
+			Uint32 thread;
+			std::string detail;
+		};
+		std::unique_ptr<Record[]> records;
+		size_t mask;
+		std::atomic<Uint64> head {0};
+		std::atomic<Uint64> frame {0};
 
-	// Private methods
-	
-	Texture create_texture(const Surface& surface) {
-		return Texture(
-			[&](){
-				auto t = SDL_CreateTextureFromSurface(ren.get(), surface.get());
-				if (!t) throw std::runtime_error("Failed to create texture.");
-				DBGMSG("Texture created.");
-				return t;
-			}(),
-			[](SDL_Texture* t) {
-				if (t) SDL_DestroyTexture(t);
-				DBGMSG("Texture destroyed.");
+		Profiler(size_t capacity, Uint64 frame_index) : frame(frame_index) {
+			size_t size = 64;
+			while (size < capacity)
+				size *= 2;
+			records.reset(new Record[size]);
+			mask = size - 1;
+		}
+
+		static Uint32 thread_id() {
+			static std::atomic<Uint32> next {0};
+			thread_local Uint32 id = next.fetch_add(1, std::memory_order_relaxed);
+			return id;
+		}
+
+		void record(
+			const char* name, Uint64 start, Uint64 end, Uint64 frame_index,
+			std::string_view detail, Uint64 count)
+		{
+			Uint64 n = head.fetch_add(1, std::memory_order_relaxed);
+			auto& r = records[n & mask];
+			r.seq.store(2 * n + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			r.name.store(name, std::memory_order_relaxed);
+			r.start.store(start, std::memory_order_relaxed);
+			r.end.store(end, std::memory_order_relaxed);
+			r.frame.store(frame_index, std::memory_order_relaxed);
+			r.count.store(count, std::memory_order_relaxed);
+			r.thread.store(thread_id(), std::memory_order_relaxed);
+			char text[detail_words * 8] {};
+			detail.copy(text, sizeof(text));
+			for (size_t i = 0; i < detail_words; i++) {
+				Uint64 word;
+				std::memcpy(&word, text + i * 8, 8);
+				r.detail[i].store(word, std::memory_order_relaxed);
 			}
-		);
-	}
-	
-public:
+			r.seq.store(2 * n + 2, std::memory_order_release);
+		}
 
-	// Structs and enums
+		// Copies the complete records of frames after first_frame,
+		// ordered by start time.
+		std::vector<Zone> snapshot(Uint64 first_frame) const {
+			std::vector<Zone> zones;
+			for (size_t i = 0; i <= mask; i++) {
+				const auto& r = records[i];
+				Uint64 seq = r.seq.load(std::memory_order_acquire);
+				if (!seq || seq & 1) continue;
+				Zone z {
+					r.name.load(std::memory_order_relaxed),
+					r.start.load(std::memory_order_relaxed),
+					r.end.load(std::memory_order_relaxed),
+					r.frame.load(std::memory_order_relaxed),
+					r.count.load(std::memory_order_relaxed),
+					r.thread.load(std::memory_order_relaxed),
+					{}
+				};
+				char text[detail_words * 8];
+				for (size_t w = 0; w < detail_words; w++) {
+					Uint64 word = r.detail[w].load(std::memory_order_relaxed);
+					std::memcpy(text + w * 8, &word, 8);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (r.seq.load(std::memory_order_relaxed) != seq || z.frame < first_frame)
+					continue;
+				z.detail.assign(text, std::find(text, text + sizeof(text), '\0'));
+				zones.push_back(std::move(z));
+			}
+			std::sort(zones.begin(), zones.end(), [](const Zone& a, const Zone& b) {
+				return a.start < b.start;
+			});
+			return zones;
+		}
+	};
 
-	/** Struct to group data to be passed to the draw functions. */
-	struct RenderData {
+	/** Records the time spent in its scope to a profiler as a zone. Does
+	 * nothing if profiling is off. */
+	class ProfileZone {
+		friend class Sdl;
+		Profiler* profiler;
+		const char* name;
+		std::string_view detail;
+		Uint64 count;
+		Uint64 frame;
+		Uint64 start;
+		ProfileZone(Profiler* p, const char* name, std::string_view detail = {}, Uint64 count = 0) :
+			profiler(p), name(name), detail(detail), count(count),
+			frame(p ? p->frame.load(std::memory_order_relaxed) : 0),
+			start(p ? SDL_GetPerformanceCounter() : 0) {}
+	public:
+		ProfileZone(const ProfileZone&) = delete;
+		ProfileZone& operator=(const ProfileZone&) = delete;
+		~ProfileZone() {
+			if (profiler)
+				profiler->record(name, start, SDL_GetPerformanceCounter(), frame, detail, count);
+		}
+	};
 
-		/** The portion of the texture to be rendered.
-		 * If nullopt, the whole texture gets rendered. */
-		std::optional<SDL_Rect> srcrect {std::nullopt};
+	/** Worker threads decoding bmps for load_texture_async. Decoded
+	 * surfaces are handed back through a bounded queue so that workers
+	 * can't run arbitrarily far ahead of the uploads. */
+	class AsyncLoader {
+		friend class Sdl;
+		struct Job {
+			Uint32 index;
+			Uint32 generation;
+			std::string path;
+			bool reload {false};
+		};
+		struct Result {
+			Uint32 index;
+			Uint32 generation;
+			SDL_Surface* surface;
+			bool reload;
+		};
+		static constexpr size_t max_results = 16;
+		std::mutex mutex;
+		std::condition_variable jobs_cv;
+		std::condition_variable results_cv;
+		std::deque<Job> jobs;
+		std::deque<Result> results;
+		size_t pending {0};
+		bool stop {false};
+		std::vector<std::thread> workers;
+		Uint32 format;
 
-		/** The target rect to render the texture over or fill with color.
-		 * If nullopt, the whole rendering target gets filled. */
-		std::optional<SDL_Rect> dstrect {std::nullopt};
+		AsyncLoader(Uint32 format) : format(format) {
+			// hardware_concurrency may return 0. One worker is kept even
+			// on a single core.
+			unsigned count = std::max(1u, std::max(1u, std::thread::hardware_concurrency()) - 1);
+			for (unsigned i = 0; i < count; i++)
+				workers.emplace_back([this]() { work(); });
+			DBGMSG("Async loader started.");
+		}
 
-		/** Variable to hold either a color or path to the texture to be used. */
-		std::variant<SDL_Color, std::string>  col_or_tex {SDL_Color{255, 0, 0, 255}};
+	public:
 
-		/** The angle by which the texture should be rotated. */
-		float angle {0.0f};
+		~AsyncLoader() {
+			{
+				std::lock_guard lock(mutex);
+				stop = true;
+			}
+			jobs_cv.notify_all();
+			results_cv.notify_all();
+			for (auto& w : workers)
+				w.join();
+			for (auto& r : results)
+				if (r.surface) SDL_FreeSurface(r.surface);
+		}
 
-		/** The texture's flip state. */
-		SDL_RendererFlip flip {SDL_FLIP_NONE};
-	};
+	private:
 
-	// Constructor
+		void work() {
+			std::unique_lock lock(mutex);
+			while (true) {
+				jobs_cv.wait(lock, [&]() { return stop || !jobs.empty(); });
+				if (stop) return;
+				Job job = std::move(jobs.front());
+				jobs.pop_front();
+				lock.unlock();
+				SDL_Surface* surface = SDL_LoadBMP(job.path.data());
+				if (surface && surface->format->format != format) {
+					SDL_Surface* converted = convert_surface(surface, format);
+					SDL_FreeSurface(surface);
+					surface = converted;
+				}
+				lock.lock();
+				results_cv.wait(lock, [&]() { return stop || results.size() < max_results; });
+				if (stop) {
+					if (surface) SDL_FreeSurface(surface);
+					return;
+				}
+				results.push_back({job.index, job.generation, surface, job.reload});
+				results_cv.notify_all();
+			}
+		}
 
-	/** Instantiates an Sdl object.
-	 * @param title The title of the window.
-	 * @param w The width of the window. 
-	 * @param h The height of the window.
-	 * @throws std::runtime_error on failure. */
-	Sdl(std::string_view title, int w, int h) :
-		base(SDL_INIT_EVERYTHING),
-		win(
+		void push(Job job) {
+			{
+				std::lock_guard lock(mutex);
+				jobs.push_back(std::move(job));
+				pending++;
+			}
+			jobs_cv.notify_one();
+		}
+
+		// Pops a decoded surface. If wait is true, blocks until one is
+		// available or nothing is pending anymore.
+		std::optional<Result> pop(bool wait) {
+			std::unique_lock lock(mutex);
+			if (wait)
+				results_cv.wait(lock, [&]() { return !results.empty() || pending == 0; });
+			if (results.empty()) return std::nullopt;
+			Result r = results.front();
+			results.pop_front();
+			pending--;
+			lock.unlock();
+			results_cv.notify_all();
+			return r;
+		}
+	};
+
+	/** Watches files for changes on a thread of its own. On Linux the
+	 * directories holding the files are watched with inotify, which also
+	 * catches editors that save by renaming a new file over the old one.
+	 * Elsewhere the modification times are compared a few times a second. */
+	class FileWatcher {
+		friend class Sdl;
+		static constexpr int poll_ms = 250;
+		std::mutex mutex;
+		std::unordered_map<std::string, std::filesystem::file_time_type> files;
+		std::vector<std::string> changed;
+		std::atomic<bool> stop {false};
+#if defined(__linux__)
+		int fd {-1};
+		// inotify returns the same descriptor for every spelling of a
+		// directory, like "assets/" and "./assets/", so each keeps all
+		// the prefixes files were added with.
+		std::unordered_map<int, std::vector<std::string>> dirs;
+#endif
+		std::thread thread;
+
+		FileWatcher() {
+#if defined(__linux__)
+			fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+			thread = std::thread([this]() { work(); });
+		}
+
+	public:
+
+		~FileWatcher() {
+			stop = true;
+			thread.join();
+#if defined(__linux__)
+			if (fd >= 0) close(fd);
+#endif
+		}
+
+	private:
+
+		void add(const std::string& path) {
+			std::lock_guard lock(mutex);
+			if (files.count(path)) return;
+			std::error_code ec;
+			files.emplace(path, std::filesystem::last_write_time(path, ec));
+#if defined(__linux__)
+			if (fd < 0) return;
+			auto slash = path.rfind('/');
+			std::string prefix = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+			for (const auto& dir : dirs)
+				if (std::find(dir.second.begin(), dir.second.end(), prefix) != dir.second.end())
+					return;
+			int wd = inotify_add_watch(
+				fd, prefix.empty() ? "." : prefix.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO
+			);
+			if (wd >= 0) dirs[wd].push_back(prefix);
+#endif
+		}
+
+		// Takes the paths of the files changed since the last call.
+		std::vector<std::string> take() {
+			std::lock_guard lock(mutex);
+			return std::exchange(changed, {});
+		}
+
+		void report(const std::string& path) {
+			if (std::find(changed.begin(), changed.end(), path) == changed.end())
+				changed.push_back(path);
+		}
+
+		void work() {
+			while (!stop) {
+#if defined(__linux__)
+				if (fd >= 0) {
+					wait_for_events();
+					continue;
+				}
+#endif
+				std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+				std::lock_guard lock(mutex);
+				for (auto& [path, time] : files) {
+					std::error_code ec;
+					auto now = std::filesystem::last_write_time(path, ec);
+					if (ec || now == time) continue;
+					time = now;
+					report(path);
+				}
+			}
+		}
+
+#if defined(__linux__)
+		void wait_for_events() {
+			pollfd ready {fd, POLLIN, 0};
+			if (::poll(&ready, 1, poll_ms) <= 0) return;
+			alignas(inotify_event) char buffer[4096];
+			ssize_t size;
+			while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+				std::lock_guard lock(mutex);
+				for (char* p = buffer; p < buffer + size;) {
+					auto event = reinterpret_cast<const inotify_event*>(p);
+					auto dir = dirs.find(event->wd);
+					if (event->len && dir != dirs.end()) {
+						for (const auto& prefix : dir->second) {
+							std::string path = prefix + event->name;
+							if (files.count(path)) report(path);
+						}
+					}
+					p += sizeof(inotify_event) + event->len;
+				}
+			}
+		}
+#endif
+	};
+
+	/** Runs loops in parallel on a fixed set of threads. Every thread
+	 * starts with an equal share of the iterations and, once it is done,
+	 * steals half of what is left from the others, so uneven iterations
+	 * keep every thread busy. */
+	class WorkerPool {
+		friend class Sdl;
+		std::mutex mutex;
+		std::condition_variable start_cv;
+		std::condition_variable done_cv;
+		std::vector<std::thread> workers;
+		std::function<void(size_t)> job;
+		// The remaining iterations of each thread, the caller's last,
+		// packed as begin << 32 | end.
+		std::vector<std::atomic<Uint64>> ranges;
+		size_t active {0};
+		Uint64 generation {0};
+		bool stop {false};
+
+		WorkerPool(unsigned count) : ranges(count + 1) {
+			for (unsigned i = 0; i < count; i++)
+				workers.emplace_back([this, i]() { work(i); });
+		}
+
+		static Uint64 pack(Uint64 begin, Uint64 end) {
+			return begin << 32 | end;
+		}
+
+		// Takes the next iteration of a thread's own range, or else
+		// steals the upper half of another thread's range.
+		bool pop(size_t self, size_t& item) {
+			auto& own = ranges[self];
+			Uint64 r = own.load();
+			while ((r >> 32) < (r & 0xFFFFFFFF)) {
+				if (own.compare_exchange_weak(r, r + (Uint64{1} << 32))) {
+					item = static_cast<size_t>(r >> 32);
+					return true;
+				}
+			}
+			for (size_t k = 1; k < ranges.size(); k++) {
+				auto& victim = ranges[(self + k) % ranges.size()];
+				Uint64 v = victim.load();
+				while (true) {
+					Uint64 begin = v >> 32;
+					Uint64 end = v & 0xFFFFFFFF;
+					if (begin >= end) break;
+					Uint64 mid = begin + (end - begin) / 2;
+					if (victim.compare_exchange_weak(v, pack(begin, mid))) {
+						own.store(pack(mid + 1, end));
+						item = static_cast<size_t>(mid);
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		void run_items(size_t self) {
+			size_t item;
+			while (pop(self, item))
+				job(item);
+		}
+
+		void work(size_t self) {
+			Uint64 seen = 0;
+			std::unique_lock lock(mutex);
+			while (true) {
+				start_cv.wait(lock, [&]() { return stop || generation != seen; });
+				if (stop) return;
+				seen = generation;
+				lock.unlock();
+				run_items(self);
+				lock.lock();
+				if (--active == 0)
+					done_cv.notify_all();
+			}
+		}
+
+		// Calls fn(i) for every i below count, on the workers and the
+		// calling thread, and returns when all calls have finished.
+		template <typename F>
+		void parallel_for(size_t count, F&& fn) {
+			if (workers.empty() || count < 2) {
+				for (size_t i = 0; i < count; i++)
+					fn(i);
+				return;
+			}
+			{
+				std::lock_guard lock(mutex);
+				job = std::forward<F>(fn);
+				for (size_t t = 0; t < ranges.size(); t++)
+					ranges[t] = pack(count * t / ranges.size(), count * (t + 1) / ranges.size());
+				active = workers.size();
+				generation++;
+			}
+			start_cv.notify_all();
+			run_items(workers.size());
+			std::unique_lock lock(mutex);
+			done_cv.wait(lock, [&]() { return active == 0; });
+		}
+
+	public:
+		~WorkerPool() {
+			{
+				std::lock_guard lock(mutex);
+				stop = true;
+			}
+			start_cv.notify_all();
+			for (auto& w : workers)
+				w.join();
+		}
+	};
+
+	/** Skyline bottom-left rectangle packer used to build texture atlases. */
+	class Skyline {
+		friend class Sdl;
+		struct Node {
+			int x;
+			int y;
+			int w;
+		};
+		int width;
+		int height;
+		std::vector<Node> nodes;
+		Skyline(int w, int h) : width(w), height(h), nodes{{0, 0, w}} {}
+
+		// Returns the lowest y at which a w x h rect fits starting at
+		// node i, or -1 if it does not fit there.
+		int fit(size_t i, int w, int h) const {
+			if (nodes[i].x + w > width) return -1;
+			int y = nodes[i].y;
+			int remaining = w;
+			for (size_t j = i; remaining > 0; j++) {
+				y = std::max(y, nodes[j].y);
+				if (y + h > height) return -1;
+				remaining -= nodes[j].w;
+			}
+			return y;
+		}
+
+		std::optional<SDL_Point> insert(int w, int h) {
+			size_t best = nodes.size();
+			int best_y = height;
+			int best_w = width + 1;
+			for (size_t i = 0; i < nodes.size(); i++) {
+				int y = fit(i, w, h);
+				if (y < 0) continue;
+				if (y + h < best_y || (y + h == best_y && nodes[i].w < best_w)) {
+					best = i;
+					best_y = y + h;
+					best_w = nodes[i].w;
+				}
+			}
+			if (best == nodes.size()) return std::nullopt;
+			SDL_Point pos {nodes[best].x, best_y - h};
+			nodes.insert(nodes.begin() + static_cast<std::ptrdiff_t>(best), {pos.x, best_y, w});
+			for (size_t i = best + 1; i < nodes.size();) {
+				int overlap = nodes[i - 1].x + nodes[i - 1].w - nodes[i].x;
+				if (overlap <= 0) break;
+				nodes[i].x += overlap;
+				nodes[i].w -= overlap;
+				if (nodes[i].w > 0) break;
+				nodes.erase(nodes.begin() + static_cast<std::ptrdiff_t>(i));
+			}
+			for (size_t i = 0; i + 1 < nodes.size();) {
+				if (nodes[i].y == nodes[i + 1].y) {
+					nodes[i].w += nodes[i + 1].w;
+					nodes.erase(nodes.begin() + static_cast<std::ptrdiff_t>(i + 1));
+				} else {
+					i++;
+				}
+			}
+			return pos;
+		}
+	};
+	
+	// Variables
+
+	/** A slot of the dense texture array. Freed slots keep their
+	 * generation so handles pointing to them can be recognized as stale.
+	 * A slot either owns its texture or refers to a region of an atlas
+	 * page stored in another slot. */
+	struct TextureSlot {
+		Texture tex {nullptr, [](SDL_Texture*){}};
+		SDL_Texture* raw {nullptr};
+		Uint32 generation {1};
+		std::string name;
+		SDL_Rect region {0, 0, 0, 0};
+		int tex_w {0};
+		int tex_h {0};
+		std::optional<Uint32> page;
+		Uint32 users {0};
+		LoadStatus status {LoadStatus::Ready};
+		SDL_BlendMode blend {SDL_BLENDMODE_NONE};
+		bool layer {false};
+		bool dirty {false};
+		size_t bytes {0};
+		Uint64 last_used {0};
+
+		// Whether the pixels are those of the bmp at name, so that it can
+		// be loaded again after an eviction. Atlas regions are never
+		// evicted but can still be hot reloaded.
+		bool reloadable {false};
+		bool from_bmp {false};
+		bool evicted {false};
+		bool pinned {false};
+		SDL_Color mod {255, 255, 255, 255};
+
+		// The mod last set on tex, which belongs to the page for regions.
+		SDL_Color applied_mod {255, 255, 255, 255};
+	};
+
+	/** A command together with the key it is sorted by. */
+	struct SortItem {
+		Uint64 key;
+		const CommandBuffer::Command* cmd;
+		Uint32 index;
+	};
+
+	// A read only view of a whole file. The file is memory mapped where
+	// mmap is available and read into memory elsewhere.
+	class MappedFile {
+		friend class Sdl;
+		const Uint8* bytes {nullptr};
+		size_t length {0};
+		std::vector<Uint8> buffer;
+		MappedFile(const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+			int fd = open(path.c_str(), O_RDONLY);
+			struct stat st;
+			if (fd < 0 || fstat(fd, &st) || st.st_size <= 0) {
+				if (fd >= 0) close(fd);
+				SDL2_CORE_THROW("Failed to open asset pack.");
+			}
+			length = static_cast<size_t>(st.st_size);
+			void* map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if (map == MAP_FAILED)
+				SDL2_CORE_THROW("Failed to map asset pack.");
+			bytes = static_cast<const Uint8*>(map);
+#else
+			auto rw = SDL_RWFromFile(path.c_str(), "rb");
+			if (!rw) SDL2_CORE_THROW("Failed to open asset pack.");
+			Sint64 size = SDL_RWsize(rw);
+			if (size > 0) {
+				buffer.resize(static_cast<size_t>(size));
+				if (SDL_RWread(rw, buffer.data(), buffer.size(), 1) != 1)
+					buffer.clear();
+			}
+			SDL_RWclose(rw);
+			if (buffer.empty())
+				SDL2_CORE_THROW("Failed to read asset pack.");
+			bytes = buffer.data();
+			length = buffer.size();
+#endif
+		}
+	public:
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+			if (bytes)
+				munmap(const_cast<Uint8*>(bytes), length);
+#endif
+		}
+	};
+
+	// Asset packs are little endian and laid out as follows:
+	//   magic "S2CPACK1", u32 entry count, then per entry
+	//   u32 name length, name, u32 pixel format, u32 w, u32 h, u32 pitch,
+	//   u64 offset of the pixels from the start of the file.
+	// The pixels of each entry are 16 byte aligned and ready to upload.
+	static constexpr char pack_magic[8] {'S', '2', 'C', 'P', 'A', 'C', 'K', '1'};
+
+	struct PackEntry {
+		std::string name;
+		Uint32 format;
+		int w;
+		int h;
+		int pitch;
+		const Uint8* pixels;
+	};
+
+	static std::vector<PackEntry> read_pack(const MappedFile& file) {
+		size_t pos = 0;
+		auto need = [&](size_t n) {
+			if (n > file.length - pos)
+				SDL2_CORE_THROW("Invalid asset pack.");
+		};
+		auto read = [&](int bytes) {
+			need(static_cast<size_t>(bytes));
+			Uint64 value = 0;
+			for (int i = 0; i < bytes; i++)
+				value |= static_cast<Uint64>(file.bytes[pos++]) << (8 * i);
+			return value;
+		};
+		need(sizeof(pack_magic));
+		if (std::memcmp(file.bytes, pack_magic, sizeof(pack_magic)))
+			SDL2_CORE_THROW("Invalid asset pack.");
+		pos += sizeof(pack_magic);
+		auto count = static_cast<Uint32>(read(4));
+		std::vector<PackEntry> entries;
+		for (Uint32 i = 0; i < count; i++) {
+			PackEntry entry;
+			auto name_length = static_cast<size_t>(read(4));
+			need(name_length);
+			entry.name.assign(reinterpret_cast<const char*>(file.bytes + pos), name_length);
+			pos += name_length;
+			entry.format = static_cast<Uint32>(read(4));
+			entry.w = static_cast<int>(read(4));
+			entry.h = static_cast<int>(read(4));
+			entry.pitch = static_cast<int>(read(4));
+			Uint64 offset = read(8);
+			Uint64 size = static_cast<Uint64>(entry.pitch) * static_cast<Uint64>(entry.h);
+			if (
+				entry.w <= 0 || entry.h <= 0 ||
+				entry.pitch < entry.w * static_cast<int>(SDL_BYTESPERPIXEL(entry.format)) ||
+				offset > file.length || size > file.length - offset
+			)
+				SDL2_CORE_THROW("Invalid asset pack.");
+			entry.pixels = file.bytes + offset;
+			entries.push_back(std::move(entry));
+		}
+		return entries;
+	}
+
+	// Wraps pixels of a mapped asset pack without copying them.
+	static Surface wrap_pixels(const PackEntry& entry) {
+		return Surface(
 			[&](){
-				auto wi = SDL_CreateWindow(title.data(), 0, 0, w, h, SDL_WINDOW_SHOWN);
-				if (!wi) throw std::runtime_error("Failed to create window.");
+				auto s = SDL_CreateRGBSurfaceWithFormatFrom(
+					const_cast<Uint8*>(entry.pixels), entry.w, entry.h,
+					static_cast<int>(SDL_BITSPERPIXEL(entry.format)), entry.pitch, entry.format
+				);
+				if (!s) SDL2_CORE_THROW("Failed to create surface.");
+				return s;
+			}(),
+			[](SDL_Surface* s) {
+				if (s) SDL_FreeSurface(s);
+			}
+		);
+	}
+
+	/** A glyph rasterized into one of the glyph pages. */
+	struct Glyph {
+		Uint32 page {0};
+		SDL_Rect rect {0, 0, 0, 0};
+		int advance {0};
+	};
+
+	/** An opened font together with the glyphs rasterized from it.
+	 * Glyphs of ASCII characters are found through a direct table,
+	 * the rest through a hash map. */
+	struct FontSlot {
+		Font font {nullptr, [](TTF_Font*){}};
+		Uint32 generation {1};
+		std::pair<std::string, int> key;
+		int line_skip {0};
+		int height {0};
+		std::vector<Glyph> glyphs;
+		std::array<Sint32, 128> ascii;
+		std::unordered_map<Uint32, Uint32> other;
+	};
+
+	/** A texture shared by the glyphs of every font. */
+	struct GlyphPage {
+		Texture tex;
+		Skyline packer;
+	};
+
+	static constexpr int glyph_page_size = 1024;
+
+	/** A quad waiting to be turned into vertices. */
+	struct Quad {
+		SDL_FRect dst;
+		SDL_FPoint uv0;
+		SDL_FPoint uv1;
+		SDL_Color col;
+		float angle;
+		SDL_RendererFlip flip;
+
+		// Set for draws covering the target, which ignore the transform.
+		bool screen {false};
+	};
+
+	// Quads per task when building vertices on the worker pool. Shorter
+	// runs of quads are built on the calling thread.
+	static constexpr size_t parallel_chunk = 1024;
+
+	/** A triangle set up for the software rasterizer. Edge functions are
+	 * positive inside and texture coordinates are planes over the screen,
+	 * all evaluated at pixel centers. */
+	struct SoftTriangle {
+		float ea[3], eb[3], ec[3];
+		bool inclusive[3];
+		float ua, ub, uc;
+		float va, vb, vc;
+		int x0, y0, x1, y1;
+		Uint32 color;
+	};
+
+	static constexpr int soft_band_height = 32;
+
+	Base base;
+	Window win;
+	Surface soft_target;
+	Renderer ren;
+	std::vector<TextureSlot> textures;
+	std::vector<Uint32> free_slots;
+	std::map<std::string, TextureId> textures_map;
+	std::vector<SDL_Vertex> batch_vertices;
+	std::vector<int> batch_indices;
+	std::vector<FontSlot> fonts;
+	std::vector<Uint32> free_fonts;
+	std::map<std::pair<std::string, int>, FontId> fonts_map;
+	std::vector<GlyphPage> glyph_pages;
+	Texture placeholder {nullptr, [](SDL_Texture*){}};
+	int async_uploads_per_frame {4};
+	std::unique_ptr<AsyncLoader> loader;
+	std::unique_ptr<FileWatcher> watcher;
+	std::unique_ptr<Profiler> profiler;
+	CommandBuffer frame_commands;
+	std::vector<SortItem> sort_items;
+	std::vector<SortItem> sort_scratch;
+	std::vector<std::pair<Uint32, SDL_Texture*>> layer_stack;
+	Uint32 texture_format {SDL_PIXELFORMAT_ARGB8888};
+	size_t texture_budget {0};
+	std::unordered_map<SDL_Texture*, Surface> soft_mirrors;
+	std::vector<SoftTriangle> soft_triangles;
+	std::unique_ptr<WorkerPool> pool;
+	std::vector<Quad> pending_quads;
+	bool culling {false};
+	std::vector<Uint8> cull_mask;
+	bool reporting {false};
+	Error reported {Error::None};
+	std::optional<SDL_Color> draw_color;
+	SDL_BlendMode draw_blend {SDL_BLENDMODE_NONE};
+	SDL_Texture* render_target {nullptr};
+	SDL_Color placeholder_mod {255, 255, 255, 255};
+	Transform xform;
+	std::vector<Transform> transform_stack;
+	Uint64 frame_index {1};
+	bool partial_redraw {false};
+	bool full_redraw {true};
+	SDL_Color clear_color {0, 0, 0, 255};
+	std::optional<SDL_Rect> pending_dirty;
+	Texture canvas {nullptr, [](SDL_Texture*){}};
+	std::vector<Uint64> frame_signatures;
+	std::vector<SDL_Rect> frame_bounds;
+	std::vector<Uint64> prev_signatures;
+	std::vector<SDL_Rect> prev_bounds;
+	bool prev_sorting {false};
+	Stats frame_stats;
+	Stats last_stats;
+	Uint64 draw_ticks {0};
+	Uint64 present_ticks {0};
+	Uint64 pace_period {0};
+	Uint64 pace_deadline {0};
+	Uint64 frame_start {0};
+	Uint64 input_tick {0};
+	Uint32 pace_divisor {1};
+	bool adaptive_pacing {false};
+	int frames_late {0};
+	int frames_early {0};
+
+	// Private methods
+	
+	Texture create_texture(const Surface& surface) {
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "create_texture"));
+		auto tex = Texture(
+			[&](){
+				auto t = SDL_CreateTextureFromSurface(ren.get(), surface.get());
+				if (!t) SDL2_CORE_THROW("Failed to create texture.");
+				DBGMSG("Texture created.");
+				return t;
+			}(),
+			[](SDL_Texture* t) {
+				if (t) SDL_DestroyTexture(t);
+				DBGMSG("Texture destroyed.");
+			}
+		);
+		if (soft_target)
+			soft_mirrors.insert_or_assign(tex.get(), Surface(
+				[&](){
+					auto s = SDL_ConvertSurfaceFormat(surface.get(), SDL_PIXELFORMAT_ARGB8888, 0);
+					if (!s) SDL2_CORE_THROW("Failed to convert surface.");
+					return s;
+				}(),
+				[](SDL_Surface* s) {
+					if (s) SDL_FreeSurface(s);
+				}
+			));
+		return tex;
+	}
+
+	// Expands rows of 24 bit pixels to 32 bits with an opaque alpha
+	// channel. If swap is true, the first and third byte of every pixel
+	// change places.
+	static void expand_24_to_32(
+		const Uint8* src, int src_pitch, Uint8* dst, int dst_pitch,
+		int w, int h, bool swap)
+	{
+		int r = swap ? 2 : 0;
+		int b = swap ? 0 : 2;
+		for (int y = 0; y < h; y++) {
+			const Uint8* in = src + y * src_pitch;
+			Uint8* out = dst + y * dst_pitch;
+			int x = 0;
+#if defined(__SSSE3__)
+			const __m128i shuffle = swap ?
+				_mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1) :
+				_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+			// Each step reads 16 bytes but only consumes 12, so stop while
+			// at least 6 pixels are left to stay inside the row.
+			for (; x + 6 <= w; x += 4) {
+				__m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + x * 3));
+				px = _mm_or_si128(_mm_shuffle_epi8(px, shuffle), alpha);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), px);
+			}
+#endif
+			for (; x < w; x++) {
+				out[x * 4 + 0] = in[x * 3 + r];
+				out[x * 4 + 1] = in[x * 3 + 1];
+				out[x * 4 + 2] = in[x * 3 + b];
+				out[x * 4 + 3] = 0xFF;
+			}
+		}
+	}
+
+	// Converts a surface to the given format without throwing, so that
+	// it can be used by the async loader's worker threads. The common
+	// case of 24 bit bmps going to 32 bit RGBA formats skips SDL's
+	// generic blitter. Surfaces without alpha stay opaque when drawn.
+	static SDL_Surface* convert_surface(SDL_Surface* src, Uint32 format) {
+		Uint32 src_format = src->format->format;
+		bool opaque = !SDL_ISPIXELFORMAT_ALPHA(src_format) && !SDL_HasColorKey(src);
+		bool fast =
+			SDL_BYTEORDER == SDL_LIL_ENDIAN && opaque && !SDL_MUSTLOCK(src) &&
+			(src_format == SDL_PIXELFORMAT_BGR24 || src_format == SDL_PIXELFORMAT_RGB24) &&
+			(format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_ABGR8888);
+		SDL_Surface* dst;
+		if (fast) {
+			dst = SDL_CreateRGBSurfaceWithFormat(0, src->w, src->h, 32, format);
+			if (!dst) return nullptr;
+			// BGR24 and ARGB8888 both store blue first on little endian.
+			bool swap = (src_format == SDL_PIXELFORMAT_BGR24) != (format == SDL_PIXELFORMAT_ARGB8888);
+			expand_24_to_32(
+				static_cast<const Uint8*>(src->pixels), src->pitch,
+				static_cast<Uint8*>(dst->pixels), dst->pitch, src->w, src->h, swap
+			);
+		} else {
+			dst = SDL_ConvertSurfaceFormat(src, format, 0);
+			if (!dst) return nullptr;
+		}
+		if (opaque)
+			SDL_SetSurfaceBlendMode(dst, SDL_BLENDMODE_NONE);
+		return dst;
+	}
+
+	// Converts a surface to the renderer's preferred texture format, so
+	// that uploading it and drawing the texture need no further conversion.
+	Surface normalize_surface(Surface sur) const {
+		if (sur->format->format == texture_format)
+			return sur;
+		return Surface(
+			[&](){
+				auto s = convert_surface(sur.get(), texture_format);
+				if (!s) SDL2_CORE_THROW("Failed to convert surface.");
+				DBGMSG("Surface converted.");
+				return s;
+			}(),
+			[](SDL_Surface* s) {
+				if (s) SDL_FreeSurface(s);
+			}
+		);
+	}
+
+	static Surface load_bmp(const std::string& path) {
+		return Surface(
+			[&](){
+				auto s = SDL_LoadBMP(path.data());
+				if (!s) SDL2_CORE_THROW("Failed to load bmp.");
+				DBGMSG("bmp loaded:");
+				DBGMSG(path);
+				return s;
+			}(),
+			[](SDL_Surface* s) {
+				if (s) SDL_FreeSurface(s);
+			}
+		);
+	}
+
+	Uint32 acquire_slot() {
+		if (free_slots.empty()) {
+			textures.emplace_back();
+			return static_cast<Uint32>(textures.size() - 1);
+		}
+		Uint32 index = free_slots.back();
+		free_slots.pop_back();
+		return index;
+	}
+
+	void release_slot(Uint32 index) {
+		auto& slot = textures[index];
+		if (!slot.name.empty())
+			textures_map.erase(slot.name);
+		if (slot.tex)
+			soft_mirrors.erase(slot.tex.get());
+		slot.tex.reset();
+		slot.raw = nullptr;
+		slot.name.clear();
+		slot.page.reset();
+		slot.users = 0;
+		slot.status = LoadStatus::Ready;
+		slot.layer = false;
+		slot.dirty = false;
+		slot.bytes = 0;
+		slot.last_used = 0;
+		slot.reloadable = false;
+		slot.from_bmp = false;
+		slot.evicted = false;
+		slot.pinned = false;
+		slot.mod = {255, 255, 255, 255};
+		slot.applied_mod = {255, 255, 255, 255};
+		slot.generation++;
+		free_slots.push_back(index);
+	}
+
+	// Formats whose pixels are split over several planes, so a row of
+	// pixels has no size in bytes.
+	static bool planar_yuv(Uint32 format) {
+		return
+			format == SDL_PIXELFORMAT_YV12 || format == SDL_PIXELFORMAT_IYUV ||
+			format == SDL_PIXELFORMAT_NV12 || format == SDL_PIXELFORMAT_NV21;
+	}
+
+	// Replaces the texture of a slot. The software rasterizer's copy of
+	// the old texture goes with it, since a later texture can be created
+	// at the same address.
+	void assign_texture(TextureSlot& slot, Texture tex) {
+		Uint32 format;
+		int w, h;
+		if (SDL_QueryTexture(tex.get(), &format, nullptr, &w, &h))
+			SDL2_CORE_THROW("Failed to query texture.");
+		if (planar_yuv(format)) {
+			// A full size Y plane and two quarter size chroma planes.
+			size_t chroma = static_cast<size_t>((w + 1) / 2) * static_cast<size_t>((h + 1) / 2);
+			slot.bytes = static_cast<size_t>(w) * static_cast<size_t>(h) + 2 * chroma;
+		} else {
+			slot.bytes = static_cast<size_t>(w) * static_cast<size_t>(h) * SDL_BYTESPERPIXEL(format);
+		}
+		if (slot.tex)
+			soft_mirrors.erase(slot.tex.get());
+		slot.tex = std::move(tex);
+		slot.raw = slot.tex.get();
+		slot.region = {0, 0, w, h};
+		slot.tex_w = w;
+		slot.tex_h = h;
+		slot.applied_mod = {255, 255, 255, 255};
+		if (SDL_GetTextureBlendMode(slot.raw, &slot.blend))
+			SDL2_CORE_THROW("Failed to query texture.");
+	}
+
+	// Textures stored with an empty name are not added to textures_map.
+	TextureId store_texture(std::string name, Texture tex) {
+		if (SDL_QueryTexture(tex.get(), nullptr, nullptr, nullptr, nullptr))
+			SDL2_CORE_THROW("Failed to query texture.");
+		Uint32 index = acquire_slot();
+		auto& slot = textures[index];
+		assign_texture(slot, std::move(tex));
+		slot.last_used = frame_index;
+		TextureId id {index, slot.generation};
+		if (!name.empty())
+			textures_map.emplace(name, id);
+		slot.name = std::move(name);
+		enforce_budget();
+		return id;
+	}
+
+	// Evicts the least recently drawn textures that can be reloaded from
+	// their bmp until the resident textures fit into the budget. Textures
+	// drawn during the current frame are kept, since a batch being built
+	// may still refer to them.
+	void enforce_budget() {
+		if (!texture_budget)
+			return;
+		size_t used = texture_memory();
+		while (used > texture_budget) {
+			TextureSlot* victim = nullptr;
+			for (auto& slot : textures) {
+				if (
+					slot.tex && slot.reloadable && !slot.pinned &&
+					slot.last_used < frame_index &&
+					(!victim || slot.last_used < victim->last_used)
+				)
+					victim = &slot;
+			}
+			if (!victim)
+				break;
+			used -= victim->bytes;
+			soft_mirrors.erase(victim->tex.get());
+			victim->tex.reset();
+			victim->raw = nullptr;
+			victim->evicted = true;
+			DBGMSG("Texture evicted.");
+		}
+	}
+
+	TextureId store_region(std::string name, Uint32 page, SDL_Rect region) {
+		Uint32 index = acquire_slot();
+		auto& page_slot = textures[page];
+		auto& slot = textures[index];
+		slot.raw = page_slot.raw;
+		slot.region = region;
+		slot.tex_w = page_slot.tex_w;
+		slot.tex_h = page_slot.tex_h;
+		slot.page = page;
+		page_slot.users++;
+		TextureId id {index, slot.generation};
+		textures_map.emplace(name, id);
+		slot.name = std::move(name);
+		return id;
+	}
+
+	// Packs the surfaces into as few pages as possible and returns the
+	// handles in the order of names. Surfaces that don't fit on a page
+	// get a texture of their own.
+	std::vector<TextureId> pack_atlas(
+		const std::vector<std::string>& names,
+		const std::vector<Surface>& surfaces)
+	{
+		constexpr int padding = 1;
+		SDL_RendererInfo info;
+		if (SDL_GetRendererInfo(ren.get(), &info))
+			SDL2_CORE_THROW("Failed to get renderer info.");
+		int page_w = info.max_texture_width > 0 ? std::min(info.max_texture_width, 4096) : 2048;
+		int page_h = info.max_texture_height > 0 ? std::min(info.max_texture_height, 4096) : 2048;
+
+		std::vector<size_t> order(surfaces.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return surfaces[a]->h > surfaces[b]->h;
+		});
+
+		struct Placement {
+			size_t page;
+			SDL_Rect rect;
+		};
+		std::vector<Skyline> packers;
+		std::vector<SDL_Point> extents;
+		std::vector<std::optional<Placement>> placements(surfaces.size());
+		for (size_t i : order) {
+			int w = surfaces[i]->w + padding;
+			int h = surfaces[i]->h + padding;
+			if (w > page_w || h > page_h) continue;
+			std::optional<SDL_Point> pos;
+			size_t p = 0;
+			for (; p < packers.size() && !pos; p++)
+				pos = packers[p].insert(w, h);
+			if (!pos) {
+				packers.push_back(Skyline(page_w, page_h));
+				extents.push_back({0, 0});
+				pos = packers.back().insert(w, h);
+				p = packers.size();
+			}
+			p--;
+			placements[i] = Placement{p, {pos->x, pos->y, surfaces[i]->w, surfaces[i]->h}};
+			extents[p].x = std::max(extents[p].x, pos->x + w);
+			extents[p].y = std::max(extents[p].y, pos->y + h);
+		}
+
+		std::vector<Uint32> pages;
+		for (size_t p = 0; p < packers.size(); p++) {
+			auto sur = Surface(
+				[&](){
+					auto s = SDL_CreateRGBSurfaceWithFormat(
+						0, extents[p].x, extents[p].y, 32, texture_format
+					);
+					if (!s) SDL2_CORE_THROW("Failed to create atlas surface.");
+					return s;
+				}(),
+				[](SDL_Surface* s) {
+					if (s) SDL_FreeSurface(s);
+				}
+			);
+			for (size_t i = 0; i < surfaces.size(); i++) {
+				if (!placements[i] || placements[i]->page != p) continue;
+				SDL_Rect dst = placements[i]->rect;
+				SDL_SetSurfaceBlendMode(surfaces[i].get(), SDL_BLENDMODE_NONE);
+				if (SDL_BlitSurface(surfaces[i].get(), nullptr, sur.get(), &dst))
+					SDL2_CORE_THROW("Failed to blit atlas surface.");
+			}
+			pages.push_back(store_texture("", create_texture(sur)).index);
+			DBGMSG("Atlas page created.");
+		}
+
+		std::vector<TextureId> ids;
+		ids.reserve(surfaces.size());
+		for (size_t i = 0; i < surfaces.size(); i++) {
+			if (placements[i])
+				ids.push_back(store_region(names[i], pages[placements[i]->page], placements[i]->rect));
+			else
+				ids.push_back(store_texture(names[i], create_texture(surfaces[i])));
+		}
+		return ids;
+	}
+
+	FontSlot& get_font(FontId id) {
+		if (
+			id.index >= fonts.size() ||
+			fonts[id.index].generation != id.generation
+		)
+			SDL2_CORE_THROW("Invalid font handle.");
+		return fonts[id.index];
+	}
+
+	// Decodes the UTF-8 sequence starting at text[i] and advances i past
+	// it. Malformed sequences decode to U+FFFD.
+	static Uint32 next_codepoint(std::string_view text, size_t& i) {
+		auto byte = [&](size_t j) { return static_cast<Uint8>(text[j]); };
+		Uint8 lead = byte(i++);
+		if (lead < 0x80) return lead;
+		int count = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+		if (count == 0 || i + static_cast<size_t>(count) > text.size()) return 0xFFFD;
+		Uint32 cp = lead & (0x3Fu >> count);
+		for (int k = 0; k < count; k++) {
+			Uint8 cont = byte(i);
+			if ((cont & 0xC0) != 0x80) return 0xFFFD;
+			cp = (cp << 6) | (cont & 0x3Fu);
+			i++;
+		}
+		return cp;
+	}
+
+	Glyph rasterize_glyph(FontSlot& font, Uint32 cp) {
+		Glyph glyph;
+		if (TTF_GlyphMetrics32(font.font.get(), cp, nullptr, nullptr, nullptr, nullptr, &glyph.advance))
+			SDL2_CORE_THROW("Failed to get glyph metrics.");
+		// Glyphs without pixels, like spaces, only take up their advance.
+		auto rendered = TTF_RenderGlyph32_Blended(font.font.get(), cp, {255, 255, 255, 255});
+		if (!rendered) return glyph;
+		auto sur = Surface(rendered, [](SDL_Surface* s) { if (s) SDL_FreeSurface(s); });
+		if (sur->format->format != SDL_PIXELFORMAT_ARGB8888) {
+			sur = Surface(
+				[&](){
+					auto s = SDL_ConvertSurfaceFormat(sur.get(), SDL_PIXELFORMAT_ARGB8888, 0);
+					if (!s) SDL2_CORE_THROW("Failed to convert glyph surface.");
+					return s;
+				}(),
+				[](SDL_Surface* s) { if (s) SDL_FreeSurface(s); }
+			);
+		}
+		int w = sur->w + 1;
+		int h = sur->h + 1;
+		if (w > glyph_page_size || h > glyph_page_size)
+			SDL2_CORE_THROW("Glyph is too large for the glyph page.");
+		std::optional<SDL_Point> pos;
+		for (glyph.page = 0; glyph.page < glyph_pages.size(); glyph.page++) {
+			pos = glyph_pages[glyph.page].packer.insert(w, h);
+			if (pos) break;
+		}
+		if (!pos) {
+			auto tex = Texture(
+				[&](){
+					auto t = SDL_CreateTexture(
+						ren.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+						glyph_page_size, glyph_page_size
+					);
+					if (!t) SDL2_CORE_THROW("Failed to create glyph page.");
+					return t;
+				}(),
+				[](SDL_Texture* t) {
+					if (t) SDL_DestroyTexture(t);
+				}
+			);
+			std::vector<Uint32> blank(glyph_page_size * glyph_page_size, 0);
+			if (
+				SDL_UpdateTexture(tex.get(), nullptr, blank.data(), glyph_page_size * 4) ||
+				SDL_SetTextureBlendMode(tex.get(), SDL_BLENDMODE_BLEND)
+			)
+				SDL2_CORE_THROW("Failed to initialize glyph page.");
+			if (soft_target)
+				soft_mirrors.insert_or_assign(tex.get(), Surface(
+					[&](){
+						auto s = SDL_CreateRGBSurfaceWithFormat(
+							0, glyph_page_size, glyph_page_size, 32, SDL_PIXELFORMAT_ARGB8888
+						);
+						if (!s) SDL2_CORE_THROW("Failed to initialize glyph page.");
+						return s;
+					}(),
+					[](SDL_Surface* s) {
+						if (s) SDL_FreeSurface(s);
+					}
+				));
+			glyph_pages.push_back({std::move(tex), Skyline(glyph_page_size, glyph_page_size)});
+			glyph.page = static_cast<Uint32>(glyph_pages.size() - 1);
+			pos = glyph_pages.back().packer.insert(w, h);
+			DBGMSG("Glyph page created.");
+		}
+		glyph.rect = {pos->x, pos->y, sur->w, sur->h};
+		if (SDL_UpdateTexture(glyph_pages[glyph.page].tex.get(), &glyph.rect, sur->pixels, sur->pitch))
+			SDL2_CORE_THROW("Failed to upload glyph.");
+		auto mirror = soft_mirrors.find(glyph_pages[glyph.page].tex.get());
+		if (mirror != soft_mirrors.end()) {
+			SDL_Rect dst = glyph.rect;
+			SDL_SetSurfaceBlendMode(sur.get(), SDL_BLENDMODE_NONE);
+			if (SDL_BlitSurface(sur.get(), nullptr, mirror->second.get(), &dst))
+				SDL2_CORE_THROW("Failed to upload glyph.");
+		}
+		return glyph;
+	}
+
+	Glyph get_glyph(FontSlot& font, Uint32 cp) {
+		if (cp < font.ascii.size() && font.ascii[cp] >= 0)
+			return font.glyphs[static_cast<size_t>(font.ascii[cp])];
+		if (cp >= font.ascii.size()) {
+			auto it = font.other.find(cp);
+			if (it != font.other.end())
+				return font.glyphs[it->second];
+		}
+		Glyph glyph = rasterize_glyph(font, cp);
+		auto index = static_cast<Uint32>(font.glyphs.size());
+		font.glyphs.push_back(glyph);
+		if (cp < font.ascii.size())
+			font.ascii[cp] = static_cast<Sint32>(index);
+		else
+			font.other.emplace(cp, index);
+		return glyph;
+	}
+
+	// Lays out the text line by line, calls emit for every glyph that has
+	// pixels and returns the bounding rect of the text.
+	template <typename Emit>
+	SDL_Rect layout_text(FontSlot& font, std::string_view text, SDL_Point pos, Emit&& emit) {
+		int x = pos.x;
+		int y = pos.y;
+		int max_x = x;
+		Uint32 prev = 0;
+		for (size_t i = 0; i < text.size();) {
+			Uint32 cp = next_codepoint(text, i);
+			if (cp == '\n') {
+				x = pos.x;
+				y += font.line_skip;
+				prev = 0;
+				continue;
+			}
+			if (prev)
+				x += TTF_GetFontKerningSizeGlyphs32(font.font.get(), prev, cp);
+			Glyph glyph = get_glyph(font, cp);
+			if (glyph.rect.w > 0)
+				emit(glyph, x, y);
+			x += glyph.advance;
+			max_x = std::max(max_x, x);
+			prev = cp;
+		}
+		return {pos.x, pos.y, max_x - pos.x, y + font.height - pos.y};
+	}
+
+	void finish_async_load(const AsyncLoader::Result& result) {
+		auto sur = Surface(result.surface, [](SDL_Surface* s) {
+			if (s) SDL_FreeSurface(s);
+		});
+		if (
+			result.index >= textures.size() ||
+			textures[result.index].generation != result.generation
+		)
+			return;
+		auto& slot = textures[result.index];
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "async_upload", slot.name));
+		if (result.reload) {
+			finish_hot_reload(slot, std::move(sur));
+			return;
+		}
+		if (!sur) {
+			slot.status = LoadStatus::Failed;
+			DBGMSG("Async texture load failed.");
+			return;
+		}
+		assign_texture(slot, create_texture(sur));
+		slot.status = LoadStatus::Ready;
+		slot.reloadable = true;
+		watch(slot);
+		slot.last_used = frame_index;
+		full_redraw = true;
+		enforce_budget();
+		DBGMSG("Async texture loaded.");
+	}
+
+	void watch(TextureSlot& slot) {
+		slot.from_bmp = true;
+		if (watcher) watcher->add(slot.name);
+	}
+
+	// Queues the bmps that changed on disk to be decoded by the loader.
+	void queue_hot_reloads() {
+		for (const auto& path : watcher->take()) {
+			auto it = textures_map.find(path);
+			if (it == textures_map.end() || !textures[it->second.index].from_bmp)
+				continue;
+			if (!loader)
+				loader.reset(new AsyncLoader(texture_format));
+			loader->push({it->second.index, it->second.generation, path, true});
+			DBGMSG("Hot reload queued.");
+		}
+	}
+
+	// Uploads a changed bmp into the texture it was loaded into. Regions
+	// are written into their atlas page and have to keep their size.
+	// Evicted textures already load the new bmp when drawn next.
+	void finish_hot_reload(TextureSlot& slot, Surface sur) {
+		if (!sur) {
+			DBGMSG("Hot reload failed.");
+			return;
+		}
+		if (slot.evicted || slot.status != LoadStatus::Ready)
+			return;
+		Uint32 format;
+		int w, h;
+		if (SDL_QueryTexture(slot.raw, &format, nullptr, &w, &h))
+			SDL2_CORE_THROW("Failed to query texture.");
+		if (slot.page && (sur->w != slot.region.w || sur->h != slot.region.h)) {
+			DBGMSG("Hot reloaded region changed size.");
+			return;
+		}
+		if (!slot.page && (sur->w != w || sur->h != h)) {
+			assign_texture(slot, create_texture(sur));
+			enforce_budget();
+		} else {
+			if (sur->format->format != format) {
+				sur = Surface(convert_surface(sur.get(), format), [](SDL_Surface* s) {
+					if (s) SDL_FreeSurface(s);
+				});
+				if (!sur) SDL2_CORE_THROW("Failed to convert surface.");
+			}
+			if (SDL_UpdateTexture(slot.raw, &slot.region, sur->pixels, sur->pitch))
+				SDL2_CORE_THROW("Failed to update texture.");
+			auto mirror = soft_mirrors.find(slot.raw);
+			if (mirror != soft_mirrors.end()) {
+				SDL_Rect dst = slot.region;
+				SDL_SetSurfaceBlendMode(sur.get(), SDL_BLENDMODE_NONE);
+				if (SDL_BlitSurface(sur.get(), nullptr, mirror->second.get(), &dst))
+					soft_mirrors.erase(mirror);
+			}
+		}
+		full_redraw = true;
+		DBGMSG("Texture hot reloaded.");
+	}
+
+	TextureSlot& get_slot(TextureId id) {
+		if (
+			id.index >= textures.size() ||
+			textures[id.index].generation != id.generation
+		)
+			SDL2_CORE_THROW("Invalid texture handle.");
+		return textures[id.index];
+	}
+
+	// Reports a failure of a call that has a try_ variant. Throws unless
+	// a try_ function is running, which then returns the first error.
+	void fail(Error error, const char* msg) {
+		if (!reporting)
+			SDL2_CORE_THROW(msg);
+		if (reported == Error::None)
+			reported = error;
+	}
+
+	// Runs a call with errors reported by fail instead of thrown. The
+	// call must not reach an error that isn't reported through fail.
+	template <typename F>
+	Error reporting_errors(F&& call) noexcept {
+		reporting = true;
+		reported = Error::None;
+		call();
+		reporting = false;
+		return reported;
+	}
+
+	// Checks what would make a draw throw in a try_ function.
+	Error check_draw(const RenderData& d) const noexcept {
+		if (!std::holds_alternative<TextureId>(d.col_or_tex))
+			return Error::None;
+		TextureId id = std::get<TextureId>(d.col_or_tex);
+		if (id.index >= textures.size() || textures[id.index].generation != id.generation)
+			return Error::InvalidHandle;
+		return textures[id.index].evicted ? Error::Evicted : Error::None;
+	}
+
+	// Looks up a texture about to be drawn. Marks it as used by the
+	// current frame and reloads it if it was evicted.
+	TextureSlot& use_slot(TextureId id) {
+		auto& slot = get_slot(id);
+		slot.last_used = frame_index;
+		if (slot.page)
+			textures[*slot.page].last_used = frame_index;
+		if (slot.evicted) {
+			assign_texture(slot, create_texture(normalize_surface(load_bmp(slot.name))));
+			slot.evicted = false;
+			DBGMSG("Texture reloaded.");
+			enforce_budget();
+		}
+		return slot;
+	}
+
+	// Looks up a texture whose pixels are about to be replaced and
+	// reloads it if it was evicted.
+	TextureSlot& writable_slot(TextureId id) {
+		auto& slot = get_slot(id);
+		if (slot.page)
+			SDL2_CORE_THROW("Cannot update an atlas region.");
+		if (slot.evicted)
+			use_slot(id);
+		if (!slot.raw)
+			SDL2_CORE_THROW("Texture is not loaded.");
+		return slot;
+	}
+
+	TextureSlot& streaming_slot(TextureId id) {
+		auto& slot = get_slot(id);
+		int access;
+		// Evicted textures were loaded from bmps, so they never stream.
+		if (
+			slot.page || !slot.raw ||
+			SDL_QueryTexture(slot.raw, nullptr, &access, nullptr, nullptr) ||
+			access != SDL_TEXTUREACCESS_STREAMING
+		)
+			SDL2_CORE_THROW("Not a streaming texture.");
+		return slot;
+	}
+
+	static bool same_color(SDL_Color a, SDL_Color b) {
+		return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+	}
+
+	static SDL_Color modulate(SDL_Color a, SDL_Color b) {
+		auto mul = [](Uint8 x, Uint8 y) {
+			return static_cast<Uint8>((x * y + 127) / 255);
+		};
+		return {mul(a.r, b.r), mul(a.g, b.g), mul(a.b, b.b), mul(a.a, b.a)};
+	}
+
+	// Makes tex the render target unless it already is.
+	void set_target(SDL_Texture* tex) {
+		if (tex == render_target)
+			return;
+		if (SDL_SetRenderTarget(ren.get(), tex))
+			SDL2_CORE_THROW("Failed to set render target.");
+		render_target = tex;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	// Sets the mod of a slot on the SDL texture it draws from, for
+	// SDL_RenderCopyEx, unless it's already set. Batched draws put the
+	// mod into the vertex colors instead.
+	void apply_mod(TextureSlot& slot) {
+		SDL_Color& applied =
+			slot.raw == placeholder.get() ? placeholder_mod :
+			slot.page ? textures[*slot.page].applied_mod : slot.applied_mod;
+		const SDL_Color& mod = slot.mod;
+		if (mod.r != applied.r || mod.g != applied.g || mod.b != applied.b) {
+			if (SDL_SetTextureColorMod(slot.raw, mod.r, mod.g, mod.b)) {
+				fail(Error::RenderFailed, "Failed to set texture color mod.");
+				return;
+			}
+			applied.r = mod.r;
+			applied.g = mod.g;
+			applied.b = mod.b;
+			SDL2_CORE_STATS(frame_stats.state_changes++);
+		}
+		if (mod.a != applied.a) {
+			if (SDL_SetTextureAlphaMod(slot.raw, mod.a)) {
+				fail(Error::RenderFailed, "Failed to set texture alpha mod.");
+				return;
+			}
+			applied.a = mod.a;
+			SDL2_CORE_STATS(frame_stats.state_changes++);
+		}
+	}
+
+	// Translates a srcrect relative to the texture into the region of
+	// the underlying SDL texture it refers to.
+	static SDL_Rect source_rect(const TextureSlot& slot, const std::optional<SDL_Rect>& srcrect) {
+		if (!srcrect.has_value())
+			return slot.region;
+		return {
+			slot.region.x + srcrect->x, slot.region.y + srcrect->y,
+			srcrect->w, srcrect->h
+		};
+	}
+
+	// Quads are written with their corners in the order top left, top
+	// right, bottom right, bottom left and rotated clockwise around their
+	// center, the same way SDL_RenderCopyEx does it. The transform, if
+	// any, is applied to the corners afterwards.
+	static void write_quad(
+		const Quad& q, const Transform* t, SDL_Vertex* vertices, int* indices, int base)
+	{
+		SDL_FPoint uv0 = q.uv0, uv1 = q.uv1;
+		if (q.flip & SDL_FLIP_HORIZONTAL) std::swap(uv0.x, uv1.x);
+		if (q.flip & SDL_FLIP_VERTICAL) std::swap(uv0.y, uv1.y);
+		float hw = q.dst.w * 0.5f;
+		float hh = q.dst.h * 0.5f;
+		float cx = q.dst.x + hw;
+		float cy = q.dst.y + hh;
+		SDL_FPoint corners[4] {{-hw, -hh}, {hw, -hh}, {hw, hh}, {-hw, hh}};
+		SDL_FPoint uvs[4] {{uv0.x, uv0.y}, {uv1.x, uv0.y}, {uv1.x, uv1.y}, {uv0.x, uv1.y}};
+		float c = 1.0f, s = 0.0f;
+		if (q.angle != 0.0f) {
+			float rad = q.angle * static_cast<float>(M_PI) / 180.0f;
+			c = std::cos(rad);
+			s = std::sin(rad);
+		}
+		for (int i = 0; i < 4; i++) {
+			SDL_FPoint p {
+				cx + corners[i].x * c - corners[i].y * s,
+				cy + corners[i].x * s + corners[i].y * c
+			};
+			if (t && !q.screen) p = t->apply(p);
+			vertices[i] = {p, q.col, uvs[i]};
+		}
+		int order[6] {0, 1, 2, 0, 2, 3};
+		for (int i = 0; i < 6; i++)
+			indices[i] = base + order[i];
+	}
+
+	const Transform* active_transform() const {
+		return xform.identity() ? nullptr : &xform;
+	}
+
+	void push_quad(const Quad& q) {
+		size_t base = batch_vertices.size();
+		batch_vertices.resize(base + 4);
+		batch_indices.resize(batch_indices.size() + 6);
+		write_quad(
+			q, active_transform(), &batch_vertices[base],
+			&batch_indices[batch_indices.size() - 6], static_cast<int>(base)
+		);
+	}
+
+	WorkerPool& worker_pool() {
+		if (!pool) {
+			unsigned count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+			pool.reset(new WorkerPool(count));
+		}
+		return *pool;
+	}
+
+	// Turns the pending quads into vertices, on the worker pool if there
+	// are enough of them, and draws them with one texture.
+	void flush_quads(SDL_Texture* tex) {
+		const size_t n = pending_quads.size();
+		if (n == 0) return;
+		batch_vertices.resize(n * 4);
+		batch_indices.resize(n * 6);
+		const Transform* t = active_transform();
+		auto build = [&](size_t chunk) {
+			size_t end = std::min(n, (chunk + 1) * parallel_chunk);
+			SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "build_vertices", {}, end - chunk * parallel_chunk));
+			for (size_t i = chunk * parallel_chunk; i < end; i++)
+				write_quad(pending_quads[i], t, &batch_vertices[i * 4], &batch_indices[i * 6], static_cast<int>(i * 4));
+		};
+		size_t chunks = (n + parallel_chunk - 1) / parallel_chunk;
+		if (chunks > 1)
+			worker_pool().parallel_for(chunks, build);
+		else
+			build(0);
+		pending_quads.clear();
+		flush_batch(tex);
+	}
+
+	// Blends a span of ARGB8888 pixels over another with SDL_BLENDMODE_BLEND.
+	static void blend_span(Uint32* dst, const Uint32* src, int n) {
+		auto div255 = [](Uint32 x) { return (x + 128 + ((x + 128) >> 8)) >> 8; };
+		int i = 0;
+#if defined(__SSE2__)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i full = _mm_set1_epi16(255);
+		const __m128i alpha_lanes = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+		const __m128i bias = _mm_set1_epi16(128);
+		auto blend = [&](__m128i s, __m128i d) {
+			__m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+			__m128i x = _mm_add_epi16(
+				_mm_mullo_epi16(s, _mm_or_si128(a, alpha_lanes)),
+				_mm_mullo_epi16(d, _mm_sub_epi16(full, a))
+			);
+			x = _mm_add_epi16(x, bias);
+			return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+		};
+		for (; i + 4 <= n; i += 4) {
+			__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+			__m128i lo = blend(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+			__m128i hi = blend(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_packus_epi16(lo, hi));
+		}
+#endif
+		for (; i < n; i++) {
+			Uint32 a = src[i] >> 24;
+			Uint32 out = (a + div255((dst[i] >> 24) * (255 - a))) << 24;
+			for (int shift = 0; shift < 24; shift += 8) {
+				Uint32 sc = (src[i] >> shift) & 0xFF;
+				Uint32 dc = (dst[i] >> shift) & 0xFF;
+				out |= div255(sc * a + dc * (255 - a)) << shift;
+			}
+			dst[i] = out;
+		}
+	}
+
+	// Rasterizes the rows from y0 to y1 of every set up triangle.
+	static void raster_band(
+		const std::vector<SoftTriangle>& tris, SDL_Surface* target,
+		const SDL_Surface* tex, bool blend, int y0, int y1, std::vector<Uint32>& span)
+	{
+		auto div255 = [](Uint32 x) { return (x + 128 + ((x + 128) >> 8)) >> 8; };
+		span.resize(static_cast<size_t>(target->w));
+		const Uint32* texels = tex ? static_cast<const Uint32*>(tex->pixels) : nullptr;
+		const int tex_stride = tex ? tex->pitch / 4 : 0;
+		for (const auto& t : tris) {
+			int top = std::max(t.y0, y0);
+			int bottom = std::min(t.y1, y1);
+			bool modulate = t.color != 0xFFFFFFFF;
+			for (int y = top; y < bottom; y++) {
+				float py = static_cast<float>(y) + 0.5f;
+				int first = -1;
+				int count = 0;
+				for (int x = t.x0; x < t.x1; x++) {
+					float px = static_cast<float>(x) + 0.5f;
+					bool inside = true;
+					for (int e = 0; e < 3 && inside; e++) {
+						float w = t.ea[e] * px + t.eb[e] * py + t.ec[e];
+						inside = w > 0.0f || (w == 0.0f && t.inclusive[e]);
+					}
+					if (!inside) {
+						if (first >= 0) break;
+						continue;
+					}
+					if (first < 0) first = x;
+					Uint32 c = t.color;
+					if (texels) {
+						float u = t.ua * px + t.ub * py + t.uc;
+						float v = t.va * px + t.vb * py + t.vc;
+						int tx = std::clamp(static_cast<int>(std::floor(u * static_cast<float>(tex->w))), 0, tex->w - 1);
+						int ty = std::clamp(static_cast<int>(std::floor(v * static_cast<float>(tex->h))), 0, tex->h - 1);
+						c = texels[ty * tex_stride + tx];
+						if (modulate) {
+							Uint32 m = 0;
+							for (int shift = 0; shift < 32; shift += 8)
+								m |= div255(((c >> shift) & 0xFF) * ((t.color >> shift) & 0xFF)) << shift;
+							c = m;
+						}
+					}
+					span[static_cast<size_t>(count++)] = c;
+				}
+				if (count == 0) continue;
+				Uint32* row = reinterpret_cast<Uint32*>(
+					static_cast<Uint8*>(target->pixels) + y * target->pitch
+				) + first;
+				if (blend)
+					blend_span(row, span.data(), count);
+				else
+					std::memcpy(row, span.data(), static_cast<size_t>(count) * 4);
+			}
+		}
+	}
+
+	// Draws the batch with the software rasterizer. Returns false if the
+	// batch needs SDL's renderer, like when drawing into a layer or with
+	// a texture that has no copy in memory. On failure, error is set and
+	// nothing is drawn.
+	bool soft_flush(SDL_Texture* tex, const char*& error) {
+		if (render_target)
+			return false;
+		const SDL_Surface* pixels = nullptr;
+		SDL_BlendMode mode;
+		if (tex) {
+			auto mirror = soft_mirrors.find(tex);
+			if (mirror == soft_mirrors.end() || SDL_GetTextureBlendMode(tex, &mode))
+				return false;
+			pixels = mirror->second.get();
+		} else {
+			mode = draw_blend;
+		}
+		if (mode != SDL_BLENDMODE_NONE && mode != SDL_BLENDMODE_BLEND)
+			return false;
+		// Like SDL's renderers, positions and the clip rect are relative
+		// to the viewport and everything is multiplied by the scale.
+		SDL_Rect viewport;
+		SDL_RenderGetViewport(ren.get(), &viewport);
+		float sx, sy;
+		SDL_RenderGetScale(ren.get(), &sx, &sy);
+		SDL_Rect area {0, 0, viewport.w, viewport.h};
+		SDL_Rect clip;
+		SDL_RenderGetClipRect(ren.get(), &clip);
+		if (!SDL_RectEmpty(&clip) && !SDL_IntersectRect(&clip, &area, &area))
+			return true;
+		auto to_pixels = [&](float x, float y) {
+			return SDL_FPoint {(static_cast<float>(viewport.x) + x) * sx, (static_cast<float>(viewport.y) + y) * sy};
+		};
+		const SDL_FPoint area0 = to_pixels(static_cast<float>(area.x), static_cast<float>(area.y));
+		const SDL_FPoint area1 = to_pixels(static_cast<float>(area.x + area.w), static_cast<float>(area.y + area.h));
+		SDL_Rect bounds {0, 0, soft_target->w, soft_target->h};
+		SDL_Rect scaled {
+			static_cast<int>(std::lround(area0.x)), static_cast<int>(std::lround(area0.y)),
+			static_cast<int>(std::lround(area1.x - area0.x)), static_cast<int>(std::lround(area1.y - area0.y))
+		};
+		if (!SDL_IntersectRect(&scaled, &bounds, &bounds))
+			return true;
+		soft_triangles.clear();
+		for (size_t i = 0; i + 2 < batch_indices.size(); i += 3) {
+			const SDL_Vertex* v[3];
+			SDL_FPoint p[3];
+			for (int k = 0; k < 3; k++) {
+				v[k] = &batch_vertices[static_cast<size_t>(batch_indices[i + static_cast<size_t>(k)])];
+				p[k] = to_pixels(v[k]->position.x, v[k]->position.y);
+			}
+			float dx1 = p[1].x - p[0].x;
+			float dy1 = p[1].y - p[0].y;
+			float dx2 = p[2].x - p[0].x;
+			float dy2 = p[2].y - p[0].y;
+			float area = dx1 * dy2 - dx2 * dy1;
+			if (area == 0.0f) continue;
+			float sign = area > 0.0f ? 1.0f : -1.0f;
+			SoftTriangle t;
+			float min_x = p[0].x, max_x = min_x;
+			float min_y = p[0].y, max_y = min_y;
+			for (int e = 0; e < 3; e++) {
+				const SDL_FPoint& a = p[e];
+				const SDL_FPoint& b = p[(e + 1) % 3];
+				t.ea[e] = -sign * (b.y - a.y);
+				t.eb[e] = sign * (b.x - a.x);
+				t.ec[e] = -(t.ea[e] * a.x + t.eb[e] * a.y);
+				// Top-left rule: pixels on an edge shared by two triangles
+				// are drawn once.
+				t.inclusive[e] = t.ea[e] > 0.0f || (t.ea[e] == 0.0f && t.eb[e] > 0.0f);
+				min_x = std::min(min_x, a.x);
+				max_x = std::max(max_x, a.x);
+				min_y = std::min(min_y, a.y);
+				max_y = std::max(max_y, a.y);
+			}
+			auto plane = [&](float q0, float q1, float q2, float& qa, float& qb, float& qc) {
+				float d1 = q1 - q0, d2 = q2 - q0;
+				qa = (d1 * dy2 - d2 * dy1) / area;
+				qb = (d2 * dx1 - d1 * dx2) / area;
+				qc = q0 - qa * p[0].x - qb * p[0].y;
+			};
+			plane(v[0]->tex_coord.x, v[1]->tex_coord.x, v[2]->tex_coord.x, t.ua, t.ub, t.uc);
+			plane(v[0]->tex_coord.y, v[1]->tex_coord.y, v[2]->tex_coord.y, t.va, t.vb, t.vc);
+			t.x0 = std::max(bounds.x, static_cast<int>(std::floor(min_x)));
+			t.y0 = std::max(bounds.y, static_cast<int>(std::floor(min_y)));
+			t.x1 = std::min(bounds.x + bounds.w, static_cast<int>(std::ceil(max_x)));
+			t.y1 = std::min(bounds.y + bounds.h, static_cast<int>(std::ceil(max_y)));
+			if (t.x0 >= t.x1 || t.y0 >= t.y1) continue;
+			const SDL_Color& c = v[0]->color;
+			t.color = Uint32{c.a} << 24 | Uint32{c.r} << 16 | Uint32{c.g} << 8 | c.b;
+			soft_triangles.push_back(t);
+		}
+		// Earlier draws may still be queued in SDL's renderer.
+		bool flushed = SDL_RenderFlush(ren.get()) == 0;
+#ifdef TEST
+		flushed = flushed && !std::exchange(fail_next_flush, false);
+#endif
+		if (!flushed) {
+			error = "Failed to flush renderer.";
+			return true;
+		}
+		bool blend = mode == SDL_BLENDMODE_BLEND;
+		int bands = (bounds.h + soft_band_height - 1) / soft_band_height;
+		worker_pool().parallel_for(static_cast<size_t>(bands), [&](size_t band) {
+			thread_local std::vector<Uint32> span;
+			int y0 = bounds.y + static_cast<int>(band) * soft_band_height;
+			int y1 = std::min(y0 + soft_band_height, bounds.y + bounds.h);
+			raster_band(soft_triangles, soft_target.get(), pixels, blend, y0, y1, span);
+		});
+		return true;
+	}
+
+	void flush_batch(SDL_Texture* tex) {
+		if (batch_indices.empty()) return;
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "flush_batch", {}, batch_indices.size() / 6));
+		const char* error = nullptr;
+		bool rasterized = soft_target && soft_flush(tex, error);
+		if (
+			!rasterized &&
+			SDL_RenderGeometry(
+				ren.get(),
+				tex,
+				batch_vertices.data(),
+				static_cast<int>(batch_vertices.size()),
+				batch_indices.data(),
+				static_cast<int>(batch_indices.size())
+			)
+		)
+			error = "Failed to render geometry.";
+		if (error) {
+			batch_vertices.clear();
+			batch_indices.clear();
+			fail(Error::RenderFailed, error);
+			return;
+		}
+		SDL2_CORE_STATS(frame_stats.draw_calls++);
+		SDL2_CORE_STATS(frame_stats.quads += batch_indices.size() / 6);
+		batch_vertices.clear();
+		batch_indices.clear();
+		DBGMSG("Batch rendered.");
+	}
+
+	// Packs layer, texture and blend mode into a 64-bit key laid out as
+	// layer << 48 | owner << 16 | blend << 8. The owner is 0 for color
+	// fills, the slot index plus one for textures, with regions of an
+	// atlas sharing their page's, and text_owner for text, so fills sort
+	// before textures and text after them within a layer.
+	static constexpr Uint32 text_owner = 0xFFFFFFFF;
+
+	static Uint64 pack_sort_key(Uint16 layer, Uint32 owner, SDL_BlendMode blend) {
+		return Uint64{layer} << 48 | Uint64{owner} << 16 | (static_cast<Uint64>(blend) & 0xFF) << 8;
+	}
+
+	Uint64 sort_key(const CommandBuffer::Command* cmd) {
+		if (cmd->type == CommandBuffer::Type::Text) {
+			auto text = static_cast<const CommandBuffer::TextCommand*>(cmd);
+			// Glyph pages are always blended.
+			return pack_sort_key(text->layer, text_owner, SDL_BLENDMODE_BLEND);
+		}
+		const auto& d = static_cast<const CommandBuffer::DrawCommand*>(cmd)->data;
+		if (!std::holds_alternative<TextureId>(d.col_or_tex))
+			return pack_sort_key(d.layer, 0, SDL_BLENDMODE_NONE);
+		const auto id = std::get<TextureId>(d.col_or_tex);
+		const auto& slot = get_slot(id);
+		Uint32 owner = slot.page ? *slot.page : id.index;
+		return pack_sort_key(d.layer, owner + 1, slot.blend);
+	}
+
+	// Stable LSD radix sort, one byte per pass. Passes over a byte that
+	// is the same in every key are skipped, which for typical scenes
+	// leaves two or three passes.
+	static void radix_sort(std::vector<SortItem>& items, std::vector<SortItem>& scratch) {
+		if (items.size() < 2) return;
+		size_t counts[8][256] {};
+		for (const auto& item : items)
+			for (int b = 0; b < 8; b++)
+				counts[b][(item.key >> (8 * b)) & 0xFF]++;
+		scratch.resize(items.size());
+		for (int b = 0; b < 8; b++) {
+			auto& c = counts[b];
+			if (c[(items[0].key >> (8 * b)) & 0xFF] == items.size()) continue;
+			size_t offset = 0;
+			for (auto& n : c) {
+				size_t count = n;
+				n = offset;
+				offset += count;
+			}
+			for (const auto& item : items)
+				scratch[c[(item.key >> (8 * b)) & 0xFF]++] = item;
+			items.swap(scratch);
+		}
+	}
+
+	void end_frame_stats() {
+		double ms_per_tick = 1000.0 / static_cast<double>(SDL_GetPerformanceFrequency());
+		frame_stats.draw_ms = static_cast<double>(draw_ticks) * ms_per_tick;
+		frame_stats.present_ms = static_cast<double>(present_ticks) * ms_per_tick;
+		last_stats = frame_stats;
+		frame_stats = {};
+		draw_ticks = 0;
+		present_ticks = 0;
+	}
+
+	// Halves the frame rate, down to a quarter, once a few frames in a row
+	// took longer than the interval, and doubles it again once frames have
+	// fit into the shorter interval with room to spare for a while.
+	void adapt_pacing(Uint64 work) {
+		Uint64 interval = pace_period * pace_divisor;
+		if (work > interval) {
+			frames_early = 0;
+			if (++frames_late >= 3 && pace_divisor < 4) {
+				pace_divisor *= 2;
+				frames_late = 0;
+			}
+		} else if (pace_divisor > 1 && work * 10 < interval / 2 * 8) {
+			frames_late = 0;
+			if (++frames_early >= 30) {
+				pace_divisor /= 2;
+				frames_early = 0;
+			}
+		} else {
+			frames_late = 0;
+			frames_early = 0;
+		}
+	}
+
+	// Waits until the next frame is due. SDL_Delay can oversleep by a
+	// scheduler tick, so the last two milliseconds are spun.
+	void pace_frame() {
+		const Uint64 freq = SDL_GetPerformanceFrequency();
+		Uint64 now = SDL_GetPerformanceCounter();
+		if (adaptive_pacing && frame_start)
+			adapt_pacing(now - frame_start);
+		const Uint64 interval = pace_period * pace_divisor;
+		if (!pace_deadline || now > pace_deadline + interval) {
+			// Late by a whole frame, so start over instead of catching up.
+			pace_deadline = now;
+		}
+		const Uint64 spin = freq / 500;
+		while (now < pace_deadline) {
+			Uint64 left = pace_deadline - now;
+			if (left > spin)
+				SDL_Delay(static_cast<Uint32>((left - spin) * 1000 / freq));
+			else
+				std::this_thread::yield();
+			now = SDL_GetPerformanceCounter();
+		}
+		pace_deadline += interval;
+	}
+
+	static Uint64 fnv1a(const void* data, size_t size, Uint64 hash) {
+		auto bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		return hash;
+	}
+
+	template <typename T>
+	static Uint64 fnv1a(const T& value, Uint64 hash) {
+		static_assert(std::has_unique_object_representations_v<T> || std::is_floating_point_v<T>);
+		return fnv1a(&value, sizeof(T), hash);
+	}
+
+	// Hashes everything that affects the pixels a command produces.
+	Uint64 command_signature(const CommandBuffer::Command* cmd) const {
+		Uint64 h = fnv1a(&xform, sizeof(Transform), 14695981039346656037ull);
+		if (cmd->type == CommandBuffer::Type::Text) {
+			auto text = static_cast<const CommandBuffer::TextCommand*>(cmd);
+			h = fnv1a(text->layer, h);
+			h = fnv1a(text->font.index, h);
+			h = fnv1a(text->font.generation, h);
+			h = fnv1a(text->pos.x, h);
+			h = fnv1a(text->pos.y, h);
+			h = fnv1a(&text->col, sizeof(SDL_Color), h);
+			return fnv1a(text->text, text->length, h);
+		}
+		const auto& d = static_cast<const CommandBuffer::DrawCommand*>(cmd)->data;
+		h = fnv1a(d.layer, h);
+		for (const auto& rect : {d.srcrect, d.dstrect}) {
+			h = fnv1a(rect.has_value(), h);
+			if (rect) h = fnv1a(&*rect, sizeof(SDL_Rect), h);
+		}
+		h = fnv1a(d.fdstrect.has_value(), h);
+		if (d.fdstrect) h = fnv1a(&*d.fdstrect, sizeof(SDL_FRect), h);
+		if (std::holds_alternative<TextureId>(d.col_or_tex)) {
+			h = fnv1a(std::get<TextureId>(d.col_or_tex).index, h);
+			h = fnv1a(std::get<TextureId>(d.col_or_tex).generation, h);
+		} else {
+			h = fnv1a(&std::get<SDL_Color>(d.col_or_tex), sizeof(SDL_Color), h);
+		}
+		h = fnv1a(d.angle, h);
+		return fnv1a(static_cast<int>(d.flip), h);
+	}
+
+	static SDL_FRect to_frect(const SDL_Rect& r) {
+		return {
+			static_cast<float>(r.x), static_cast<float>(r.y),
+			static_cast<float>(r.w), static_cast<float>(r.h)
+		};
+	}
+
+	// The smallest integer rect covering a float one.
+	static SDL_Rect covering_rect(float x0, float y0, float x1, float y1) {
+		int ix0 = static_cast<int>(std::floor(x0));
+		int iy0 = static_cast<int>(std::floor(y0));
+		int ix1 = static_cast<int>(std::ceil(x1));
+		int iy1 = static_cast<int>(std::ceil(y1));
+		return {ix0, iy0, ix1 - ix0, iy1 - iy0};
+	}
+
+	// The axis aligned bounds of a rect rotated around its center.
+	static SDL_Rect rotated_bounds(const SDL_FRect& r, float angle) {
+		if (angle == 0.0f)
+			return covering_rect(r.x, r.y, r.x + r.w, r.y + r.h);
+		float rad = angle * static_cast<float>(M_PI) / 180.0f;
+		float c = std::fabs(std::cos(rad));
+		float s = std::fabs(std::sin(rad));
+		float hw = r.w * 0.5f;
+		float hh = r.h * 0.5f;
+		float ex = hw * c + hh * s;
+		float ey = hw * s + hh * c;
+		float cx = r.x + hw;
+		float cy = r.y + hh;
+		return covering_rect(cx - ex, cy - ey, cx + ex, cy + ey);
+	}
+
+	static std::optional<SDL_FRect> dst_frect(const RenderData& d) {
+		if (d.fdstrect) return d.fdstrect;
+		if (d.dstrect) return to_frect(*d.dstrect);
+		return std::nullopt;
+	}
+
+	// The bounds of a draw before the transform, or nullopt for draws
+	// covering the target.
+	static std::optional<SDL_Rect> dst_bounds(const RenderData& d) {
+		auto dst = dst_frect(d);
+		if (!dst) return std::nullopt;
+		return rotated_bounds(*dst, d.angle);
+	}
+
+	// The bounds of a rect after the current transform.
+	SDL_Rect transform_bounds(const SDL_Rect& r) const {
+		if (xform.identity())
+			return r;
+		SDL_FRect f = to_frect(r);
+		SDL_FPoint corners[4] {
+			xform.apply({f.x, f.y}), xform.apply({f.x + f.w, f.y}),
+			xform.apply({f.x + f.w, f.y + f.h}), xform.apply({f.x, f.y + f.h})
+		};
+		float x0 = corners[0].x, y0 = corners[0].y, x1 = x0, y1 = y0;
+		for (const auto& p : corners) {
+			x0 = std::min(x0, p.x);
+			y0 = std::min(y0, p.y);
+			x1 = std::max(x1, p.x);
+			y1 = std::max(y1, p.y);
+		}
+		return covering_rect(x0, y0, x1, y1);
+	}
+
+	SDL_Rect command_bounds(const CommandBuffer::Command* cmd, const SDL_Rect& target) {
+		if (cmd->type == CommandBuffer::Type::Text) {
+			auto text = static_cast<const CommandBuffer::TextCommand*>(cmd);
+			return transform_bounds(layout_text(
+				get_font(text->font), {text->text, text->length}, text->pos,
+				[](const Glyph&, int, int) {}
+			));
+		}
+		const auto& d = static_cast<const CommandBuffer::DrawCommand*>(cmd)->data;
+		auto bounds = dst_bounds(d);
+		return bounds ? transform_bounds(*bounds) : target;
+	}
+
+	static void add_dirty(std::optional<SDL_Rect>& dirty, const SDL_Rect& rect) {
+		if (rect.w <= 0 || rect.h <= 0) return;
+		// One pixel of margin covers pixels touched by filtering.
+		SDL_Rect grown {rect.x - 1, rect.y - 1, rect.w + 2, rect.h + 2};
+		if (dirty)
+			SDL_UnionRect(&*dirty, &grown, &*dirty);
+		else
+			dirty = grown;
+	}
+
+	// Draws the frame's command buffer into the canvas, limited to the
+	// area that changed since the previous frame, and presents the canvas.
+	// Returns false if nothing changed and presenting was skipped.
+	bool present_partial() {
+		int w, h;
+		if (SDL_GetRendererOutputSize(ren.get(), &w, &h))
+			SDL2_CORE_THROW("Failed to get renderer output size.");
+		int canvas_w = 0, canvas_h = 0;
+		if (canvas)
+			SDL_QueryTexture(canvas.get(), nullptr, nullptr, &canvas_w, &canvas_h);
+		if (!canvas || canvas_w != w || canvas_h != h) {
+			canvas = Texture(
+				[&](){
+					auto t = SDL_CreateTexture(
+						ren.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h
+					);
+					if (!t) SDL2_CORE_THROW("Failed to create canvas.");
+					return t;
+				}(),
+				[](SDL_Texture* t) {
+					if (t) SDL_DestroyTexture(t);
+				}
+			);
+			full_redraw = true;
+		}
+		// Turning sorting on or off can restack every command.
+		if (frame_commands.sorting != prev_sorting) {
+			prev_sorting = frame_commands.sorting;
+			full_redraw = true;
+		}
+		SDL_Rect screen {0, 0, w, h};
+		frame_signatures.clear();
+		frame_bounds.clear();
+		for (auto cmd = frame_commands.head; cmd; cmd = cmd->next) {
+			frame_signatures.push_back(command_signature(cmd));
+			frame_bounds.push_back(command_bounds(cmd, screen));
+		}
+		std::optional<SDL_Rect> dirty = pending_dirty;
+		pending_dirty.reset();
+		if (full_redraw) {
+			dirty = screen;
+		} else {
+			size_t count = std::max(frame_signatures.size(), prev_signatures.size());
+			for (size_t i = 0; i < count; i++) {
+				bool in_frame = i < frame_signatures.size();
+				bool in_prev = i < prev_signatures.size();
+				if (in_frame && in_prev && frame_signatures[i] == prev_signatures[i])
+					continue;
+				if (in_frame) add_dirty(dirty, frame_bounds[i]);
+				if (in_prev) add_dirty(dirty, prev_bounds[i]);
+			}
+		}
+		std::swap(frame_signatures, prev_signatures);
+		std::swap(frame_bounds, prev_bounds);
+		SDL_Rect clip;
+		if (!dirty || !SDL_IntersectRect(&*dirty, &screen, &clip)) {
+			frame_commands.reset();
+			DBGMSG("Present skipped.");
+			return false;
+		}
+		set_target(canvas.get());
+		if (SDL_RenderSetClipRect(ren.get(), &clip))
+			SDL2_CORE_THROW("Failed to set render target.");
+		set_draw_color(clear_color);
+		// Replace the dirty pixels like SDL_RenderClear, whatever blend
+		// mode fills use.
+		if (
+			(draw_blend != SDL_BLENDMODE_NONE && SDL_SetRenderDrawBlendMode(ren.get(), SDL_BLENDMODE_NONE)) ||
+			SDL_RenderFillRect(ren.get(), &clip) ||
+			(draw_blend != SDL_BLENDMODE_NONE && SDL_SetRenderDrawBlendMode(ren.get(), draw_blend))
+		)
+			SDL2_CORE_THROW("Failed to clear renderer.");
+		submit_commands(frame_commands, &clip, &prev_bounds);
+		frame_commands.reset();
+		if (SDL_RenderSetClipRect(ren.get(), nullptr))
+			SDL2_CORE_THROW("Failed to present canvas.");
+		set_target(nullptr);
+		if (SDL_RenderCopy(ren.get(), canvas.get(), nullptr, nullptr))
+			SDL2_CORE_THROW("Failed to present canvas.");
+		full_redraw = false;
+		DBGMSG("Partial redraw presented.");
+		return true;
+	}
+
+	// Draws the commands of a command buffer. If clip is given, commands
+	// whose bounds, listed in recording order, miss it are skipped.
+	void submit_commands(
+		const CommandBuffer& commands,
+		const SDL_Rect* clip = nullptr,
+		const std::vector<SDL_Rect>* bounds = nullptr)
+	{
+		auto visible = [&](Uint32 index) {
+			return !clip || SDL_HasIntersection(clip, &(*bounds)[index]);
+		};
+		Batch batch = begin_batch();
+		Uint32 index = 0;
+		if (commands.sorting) {
+			sort_items.clear();
+			for (auto cmd = commands.head; cmd; cmd = cmd->next, index++)
+				sort_items.push_back({sort_key(cmd), cmd, index});
+			radix_sort(sort_items, sort_scratch);
+			for (const auto& item : sort_items)
+				if (visible(item.index)) batch_command(batch, item.cmd);
+		} else {
+			for (auto cmd = commands.head; cmd; cmd = cmd->next, index++)
+				if (visible(index)) batch_command(batch, cmd);
+		}
+		flush_batch(batch.tex);
+	}
+
+	/** The state of the batch being built by the draw functions. */
+	struct Batch {
+		SDL_Texture* tex {nullptr};
+		std::optional<SDL_Rect> target;
+		std::optional<SDL_Rect> view;
+		bool culled_ahead {false};
+	};
+
+	// The visible part of the current target in draw coordinates.
+	SDL_Rect cull_view() {
+		SDL_Rect viewport, clip;
+		SDL_RenderGetViewport(ren.get(), &viewport);
+		SDL_Rect view {0, 0, viewport.w, viewport.h};
+		SDL_RenderGetClipRect(ren.get(), &clip);
+		if (!SDL_RectEmpty(&clip) && !SDL_IntersectRect(&clip, &view, &view))
+			view = {0, 0, 0, 0};
+		return view;
+	}
+
+	// Draws without a dstrect cover the whole target and are always visible.
+	bool intersects_view(const RenderData& d, const SDL_Rect& view) const {
+		auto bounds = dst_bounds(d);
+		if (!bounds)
+			return true;
+		SDL_Rect r = transform_bounds(*bounds);
+		return
+			r.x < view.x + view.w && r.x + r.w > view.x &&
+			r.y < view.y + view.h && r.y + r.h > view.y;
+	}
+
+	// Tests an array of draws against the view. Unrotated integer rects
+	// are tested four at a time where SSE2 is available, unless there is
+	// a transform.
+	void cull_draws(
+		const RenderData* data, size_t count, const SDL_Rect& view, std::vector<Uint8>& visible) const
+	{
+		visible.resize(count);
+		size_t i = 0;
+#if defined(__SSE2__)
+		const __m128i x0 = _mm_set1_epi32(view.x);
+		const __m128i y0 = _mm_set1_epi32(view.y);
+		const __m128i x1 = _mm_set1_epi32(view.x + view.w);
+		const __m128i y1 = _mm_set1_epi32(view.y + view.h);
+		const bool simd = xform.identity();
+		for (; simd && i + 4 <= count; i += 4) {
+			const RenderData* d = data + i;
+			bool simple = true;
+			for (int k = 0; k < 4; k++)
+				simple = simple && d[k].dstrect.has_value() && !d[k].fdstrect.has_value() && d[k].angle == 0.0f;
+			if (!simple) {
+				for (size_t k = 0; k < 4; k++)
+					visible[i + k] = intersects_view(d[k], view);
+				continue;
+			}
+			const SDL_Rect &a = *d[0].dstrect, &b = *d[1].dstrect, &c = *d[2].dstrect, &e = *d[3].dstrect;
+			__m128i rx = _mm_setr_epi32(a.x, b.x, c.x, e.x);
+			__m128i ry = _mm_setr_epi32(a.y, b.y, c.y, e.y);
+			__m128i rw = _mm_setr_epi32(a.w, b.w, c.w, e.w);
+			__m128i rh = _mm_setr_epi32(a.h, b.h, c.h, e.h);
+			__m128i in = _mm_and_si128(
+				_mm_cmplt_epi32(rx, x1), _mm_cmpgt_epi32(_mm_add_epi32(rx, rw), x0)
+			);
+			in = _mm_and_si128(in, _mm_cmplt_epi32(ry, y1));
+			in = _mm_and_si128(in, _mm_cmpgt_epi32(_mm_add_epi32(ry, rh), y0));
+			int mask = _mm_movemask_ps(_mm_castsi128_ps(in));
+			for (size_t k = 0; k < 4; k++)
+				visible[i + k] = (mask >> k) & 1;
+		}
+#endif
+		for (; i < count; i++)
+			visible[i] = intersects_view(data[i], view);
+	}
+
+	// Returns true if culling is enabled and the draw is off the target.
+	bool cull(const RenderData& d, std::optional<SDL_Rect>& view) {
+		if (!culling)
+			return false;
+		if (!view)
+			view = cull_view();
+		if (intersects_view(d, *view))
+			return false;
+		SDL2_CORE_STATS(frame_stats.culled++);
+		return true;
+	}
+
+	// Drops vertices left over by a draw that threw halfway.
+	Batch begin_batch() {
+		batch_vertices.clear();
+		batch_indices.clear();
+		return {};
+	}
+
+	void bind_batch(Batch& batch, SDL_Texture* tex) {
+		if (tex != batch.tex) {
+			SDL2_CORE_STATS(if (!batch_indices.empty()) frame_stats.batch_breaks++);
+			SDL2_CORE_STATS(if (tex) frame_stats.textures_bound++);
+			flush_batch(batch.tex);
+			batch.tex = tex;
+		}
+	}
+
+	// Looks up the texture and source region of a draw. Draws without a
+	// dstrect cover the target, which is queried once per batch.
+	Quad resolve_draw(
+		const RenderData& d, std::optional<SDL_Rect>& target, SDL_Texture*& tex)
+	{
+		if (!d.dstrect.has_value() && !d.fdstrect.has_value() && !target.has_value()) {
+			SDL_Rect viewport;
+			SDL_RenderGetViewport(ren.get(), &viewport);
+			target = SDL_Rect{0, 0, viewport.w, viewport.h};
+		}
+		auto given = dst_frect(d);
+		const SDL_FRect dst = given ? *given : to_frect(*target);
+		const bool screen = !given;
+		if (!std::holds_alternative<TextureId>(d.col_or_tex)) {
+			tex = nullptr;
+			return {dst, {0.0f, 0.0f}, {0.0f, 0.0f}, std::get<SDL_Color>(d.col_or_tex), 0.0f, SDL_FLIP_NONE, screen};
+		}
+		auto& slot = use_slot(std::get<TextureId>(d.col_or_tex));
+		tex = slot.raw;
+		SDL_Rect src = source_rect(slot, d.srcrect);
+		float tw = static_cast<float>(slot.tex_w);
+		float th = static_cast<float>(slot.tex_h);
+		return {
+			dst,
+			{static_cast<float>(src.x) / tw, static_cast<float>(src.y) / th},
+			{static_cast<float>(src.x + src.w) / tw, static_cast<float>(src.y + src.h) / th},
+			slot.mod,
+			d.angle,
+			d.flip,
+			screen
+		};
+	}
+
+	void batch_draw(Batch& batch, const RenderData& d) {
+		if (!batch.culled_ahead && cull(d, batch.view))
+			return;
+		SDL_Texture* tex;
+		Quad q = resolve_draw(d, batch.target, tex);
+		bind_batch(batch, tex);
+		push_quad(q);
+	}
+
+	// Builds the vertices of a static batch cell in batch coordinates,
+	// split into runs of quads sharing a texture.
+	void build_cell(StaticBatch::Cell& cell) {
+		cell.vertices.resize(cell.items.size() * 4);
+		cell.runs.clear();
+		std::optional<SDL_Rect> target;
+		int indices[6];
+		for (size_t i = 0; i < cell.items.size(); i++) {
+			const RenderData& d = cell.items[i];
+			SDL_Texture* tex;
+			Quad q = resolve_draw(d, target, tex);
+			bool textured = std::holds_alternative<TextureId>(d.col_or_tex);
+			// Texture mods are applied when the cell is drawn.
+			if (textured) q.col = {255, 255, 255, 255};
+			write_quad(q, nullptr, &cell.vertices[i * 4], indices, 0);
+			TextureId id = textured ? std::get<TextureId>(d.col_or_tex) : TextureId{};
+			if (cell.runs.empty() || cell.runs.back().textured != textured || cell.runs.back().id != id) {
+				cell.runs.push_back({id, textured, 0, {}, 0, 0});
+				if (textured) {
+					const auto& slot = textures[id.index];
+					cell.runs.back().region = slot.region;
+					cell.runs.back().tex_w = slot.tex_w;
+					cell.runs.back().tex_h = slot.tex_h;
+				}
+			}
+			cell.runs.back().quads++;
+		}
+		cell.built = true;
+	}
+
+	// Checks that the textures of a built cell still have the layout its
+	// UVs were built for.
+	bool cell_current(const StaticBatch::Cell& cell) {
+		for (const auto& run : cell.runs) {
+			if (!run.textured) continue;
+			const auto& slot = use_slot(run.id);
+			if (
+				!SDL_RectEquals(&slot.region, &run.region) ||
+				slot.tex_w != run.tex_w || slot.tex_h != run.tex_h
+			)
+				return false;
+		}
+		return true;
+	}
+
+	// Appends prebuilt quads to the batch, moved by an offset, transformed
+	// and multiplied by a texture mod.
+	void append_quads(
+		const SDL_Vertex* vertices, size_t quads, float dx, float dy, SDL_Color mod)
+	{
+		const bool tinted = !same_color(mod, {255, 255, 255, 255});
+		size_t base = batch_vertices.size();
+		batch_vertices.resize(base + quads * 4);
+		batch_indices.reserve(batch_indices.size() + quads * 6);
+		const Transform* t = active_transform();
+		for (size_t i = 0; i < quads * 4; i++) {
+			SDL_Vertex v = vertices[i];
+			v.position.x += dx;
+			v.position.y += dy;
+			if (t) v.position = t->apply(v.position);
+			if (tinted) v.color = modulate(v.color, mod);
+			batch_vertices[base + i] = v;
+		}
+		for (size_t i = 0; i < quads; i++) {
+			int b = static_cast<int>(base + i * 4);
+			for (int k : {0, 1, 2, 0, 2, 3})
+				batch_indices.push_back(b + k);
+		}
+	}
+
+	SDL_Rect batch_text(
+		Batch& batch, std::string_view text, SDL_Point pos, SDL_Color col, FontId font)
+	{
+		const float size = static_cast<float>(glyph_page_size);
+		return layout_text(get_font(font), text, pos, [&](const Glyph& glyph, int x, int y) {
+			bind_batch(batch, glyph_pages[glyph.page].tex.get());
+			const SDL_Rect& r = glyph.rect;
+			push_quad({
+				to_frect({x, y, r.w, r.h}),
+				{static_cast<float>(r.x) / size, static_cast<float>(r.y) / size},
+				{static_cast<float>(r.x + r.w) / size, static_cast<float>(r.y + r.h) / size},
+				col, 0.0f, SDL_FLIP_NONE
+			});
+		});
+	}
+
+	void batch_command(Batch& batch, const CommandBuffer::Command* cmd) {
+		if (cmd->type == CommandBuffer::Type::Draw) {
+			batch_draw(batch, static_cast<const CommandBuffer::DrawCommand*>(cmd)->data);
+		} else {
+			auto text = static_cast<const CommandBuffer::TextCommand*>(cmd);
+			batch_text(batch, {text->text, text->length}, text->pos, text->col, text->font);
+		}
+	}
+	
+public:
+
+	// Constructor
+
+	/** Instantiates an Sdl object.
+	 * @param title The title of the window.
+	 * @param w The width of the window. 
+	 * @param h The height of the window.
+	 * @throws std::runtime_error on failure. */
+	Sdl(std::string_view title, int w, int h) : Sdl(title, w, h, Config{}) {}
+
+	/** Instantiates an Sdl object with custom options.
+	 * @param title The title of the window.
+	 * @param w The width of the window. 
+	 * @param h The height of the window.
+	 * @param config The options to be used.
+	 * @throws std::runtime_error on failure. */
+	Sdl(std::string_view title, int w, int h, const Config& config) :
+		base(config.init_flags),
+		win(
+			[&]() -> SDL_Window* {
+				if (config.software_renderer) return nullptr;
+				auto wi = SDL_CreateWindow(
+					title.data(), config.window_pos.x, config.window_pos.y, w, h,
+					config.window_flags
+				);
+				if (!wi) SDL2_CORE_THROW("Failed to create window.");
 				DBGMSG("Window created.");
 				return wi;
 			}(),
@@ -161,10 +3308,26 @@ public:
 				DBGMSG("Window destroyed.");
 			}
 		),
+		soft_target(
+			[&]() -> SDL_Surface* {
+				if (!config.software_renderer) return nullptr;
+				auto su = SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888);
+				if (!su) SDL2_CORE_THROW("Failed to create framebuffer.");
+				return su;
+			}(),
+			[](SDL_Surface* s) {
+				if (s) SDL_FreeSurface(s);
+			}
+		),
 		ren(
 			[&](){
-				auto r = SDL_CreateRenderer(win.get(), -1, SDL_RENDERER_PRESENTVSYNC);
-				if (!r) throw std::runtime_error("Failed to create renderer.");
+				if (!config.driver.empty())
+					SDL_SetHint(SDL_HINT_RENDER_DRIVER, config.driver.data());
+				SDL_SetHint(SDL_HINT_RENDER_BATCHING, config.render_batching ? "1" : "0");
+				auto r = soft_target ?
+					SDL_CreateSoftwareRenderer(soft_target.get()) :
+					SDL_CreateRenderer(win.get(), -1, config.renderer_flags);
+				if (!r) SDL2_CORE_THROW("Failed to create renderer.");
 				DBGMSG("Renderer created.");
 				return r;
 			}(),
@@ -172,78 +3335,381 @@ public:
 				if (r) SDL_DestroyRenderer(r);
 				DBGMSG("Renderer destroyed.");
 			}
-		)
-	{};
-
-	// Public methods
+		)
+	{
+		// Prefer the first 32 bit format with alpha the renderer lists,
+		// which is the one it can upload without converting.
+		SDL_RendererInfo info;
+		if (SDL_GetRendererInfo(ren.get(), &info))
+			SDL2_CORE_THROW("Failed to get renderer info.");
+		for (Uint32 i = 0; i < info.num_texture_formats; i++) {
+			Uint32 format = info.texture_formats[i];
+			if (
+				!SDL_ISPIXELFORMAT_FOURCC(format) && SDL_BITSPERPIXEL(format) == 32 &&
+				SDL_ISPIXELFORMAT_ALPHA(format)
+			) {
+				texture_format = format;
+				break;
+			}
+		}
+	}
+
+	// Public methods
+
+	/** Loads and stores a texture.
+	 * @param path The path to the bmp to be used.
+	 * @return The handle of the texture. If the texture was loaded
+	 * earlier, the existing handle is returned.
+	 * @throws std::runtime_error on failure. */
+	TextureId load_texture(const std::string& path) {
+		auto maybe_tex = textures_map.find(path);
+		if (maybe_tex != textures_map.end()) {
+			DBGMSG("Texture was loaded earlier.");
+			return maybe_tex->second;
+		}
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "load_texture", path));
+		auto sur = normalize_surface(load_bmp(path));
+		auto id = store_texture(path, create_texture(sur));
+		textures[id.index].reloadable = true;
+		watch(textures[id.index]);
+		DBGMSG("New texture loaded.");
+		return id;
+	}
+
+	/** Loads a vector of textures.
+	 * @param paths A vector of strings containing the paths to be used.
+	 * @param atlas If true, the textures not loaded earlier are packed
+	 * into shared atlas pages so that they can be drawn in one batch.
+	 * The draw functions select the right region of the page on their own.
+	 * @return The handles of the textures in the order of paths.
+	 * @throws std::runtime_error on failure. */
+	std::vector<TextureId> load_texture(
+		const std::vector<std::string>& paths, bool atlas = false)
+	{
+		std::vector<TextureId> ids;
+		ids.reserve(paths.size());
+		if (!atlas) {
+			for (const auto& path : paths) {
+				ids.push_back(load_texture(path));
+			}
+			return ids;
+		}
+		std::vector<std::string> names;
+		std::vector<Surface> surfaces;
+		for (const auto& path : paths) {
+			if (
+				textures_map.find(path) != textures_map.end() ||
+				std::find(names.begin(), names.end(), path) != names.end()
+			)
+				continue;
+			surfaces.push_back(normalize_surface(load_bmp(path)));
+			names.push_back(path);
+		}
+		for (const auto& id : pack_atlas(names, surfaces))
+			watch(textures[id.index]);
+		for (const auto& path : paths) {
+			ids.push_back(textures_map.find(path)->second);
+		}
+		DBGMSG("Atlas loaded.");
+		return ids;
+	}
+
+	/** @return The surface rendered into when Config::software_renderer
+	 * is set, or nullptr. It is complete after present. */
+	const SDL_Surface* framebuffer() const {
+		return soft_target.get();
+	}
+
+	/** @return The pixel format textures are converted to on load, the
+	 * first 32 bit format with alpha the renderer supports. Asset packs
+	 * written in this format load without any conversion. */
+	Uint32 preferred_texture_format() const {
+		return texture_format;
+	}
+
+	/** Builds an asset pack out of bmp files. The images are converted
+	 * to the given pixel format ahead of time, so that loading the pack
+	 * needs neither per-file I/O nor conversion. Textures loaded from a
+	 * pack are named after the paths used here, so find_texture and
+	 * load_texture treat them the same as textures loaded from the bmps.
+	 * Doesn't need an Sdl object.
+	 * @param pack_path The path of the pack to be written.
+	 * @param paths The paths to the bmps to be packed.
+	 * @param format The pixel format to store, ideally the renderer's
+	 * preferred texture format.
+	 * @throws std::runtime_error on failure. */
+	static void write_asset_pack(
+		const std::string& pack_path, const std::vector<std::string>& paths,
+		Uint32 format = SDL_PIXELFORMAT_ARGB8888)
+	{
+		std::vector<Surface> surfaces;
+		for (const auto& path : paths) {
+			auto sur = load_bmp(path);
+			surfaces.emplace_back(
+				[&](){
+					auto s = convert_surface(sur.get(), format);
+					if (!s) SDL2_CORE_THROW("Failed to convert surface.");
+					return s;
+				}(),
+				[](SDL_Surface* s) {
+					if (s) SDL_FreeSurface(s);
+				}
+			);
+		}
+		std::vector<Uint8> out(pack_magic, pack_magic + sizeof(pack_magic));
+		auto write = [&](Uint64 value, int bytes) {
+			for (int i = 0; i < bytes; i++)
+				out.push_back(static_cast<Uint8>(value >> (8 * i)));
+		};
+		write(paths.size(), 4);
+		std::vector<size_t> offsets;
+		for (size_t i = 0; i < paths.size(); i++) {
+			write(paths[i].size(), 4);
+			out.insert(out.end(), paths[i].begin(), paths[i].end());
+			write(format, 4);
+			write(static_cast<Uint64>(surfaces[i]->w), 4);
+			write(static_cast<Uint64>(surfaces[i]->h), 4);
+			write(static_cast<Uint64>(surfaces[i]->pitch), 4);
+			offsets.push_back(out.size());
+			write(0, 8);
+		}
+		for (size_t i = 0; i < paths.size(); i++) {
+			out.resize((out.size() + 15) & ~size_t{15});
+			size_t offset = out.size();
+			for (int b = 0; b < 8; b++)
+				out[offsets[i] + static_cast<size_t>(b)] = static_cast<Uint8>(offset >> (8 * b));
+			auto pixels = static_cast<const Uint8*>(surfaces[i]->pixels);
+			out.insert(
+				out.end(), pixels,
+				pixels + static_cast<size_t>(surfaces[i]->pitch) * static_cast<size_t>(surfaces[i]->h)
+			);
+		}
+		auto rw = SDL_RWFromFile(pack_path.c_str(), "wb");
+		if (!rw) SDL2_CORE_THROW("Failed to open asset pack.");
+		bool written = SDL_RWwrite(rw, out.data(), out.size(), 1) == 1;
+		if (SDL_RWclose(rw) || !written)
+			SDL2_CORE_THROW("Failed to write asset pack.");
+		DBGMSG("Asset pack written.");
+	}
+
+	/** Loads every texture of an asset pack built by write_asset_pack.
+	 * The pack is memory mapped and the textures are uploaded straight
+	 * from the mapping.
+	 * @param path The path to the asset pack.
+	 * @param atlas If true, the textures are packed into shared atlas
+	 * pages like load_texture does.
+	 * @return The handles of the textures in the order they were packed.
+	 * Textures loaded earlier under the same name keep their handles.
+	 * @throws std::runtime_error on failure. */
+	std::vector<TextureId> load_asset_pack(const std::string& path, bool atlas = false) {
+		MappedFile file(path);
+		auto entries = read_pack(file);
+		std::vector<std::string> names;
+		std::vector<Surface> surfaces;
+		for (const auto& entry : entries) {
+			if (
+				textures_map.find(entry.name) != textures_map.end() ||
+				std::find(names.begin(), names.end(), entry.name) != names.end()
+			)
+				continue;
+			auto sur = wrap_pixels(entry);
+			if (!atlas) {
+				store_texture(entry.name, create_texture(sur));
+				continue;
+			}
+			surfaces.push_back(std::move(sur));
+			names.push_back(entry.name);
+		}
+		if (atlas)
+			pack_atlas(names, surfaces);
+		std::vector<TextureId> ids;
+		ids.reserve(entries.size());
+		for (const auto& entry : entries)
+			ids.push_back(textures_map.find(entry.name)->second);
+		DBGMSG("Asset pack loaded.");
+		return ids;
+	}
 
-	/** Loads and stores a texture.
+	/** Starts loading a texture on a worker thread. The returned handle
+	 * can be drawn right away and shows a placeholder until the texture
+	 * has been uploaded by present() or process_async_loads().
 	 * @param path The path to the bmp to be used.
+	 * @return The handle of the texture. If the texture was loaded or
+	 * requested earlier, the existing handle is returned.
 	 * @throws std::runtime_error on failure. */
-	void load_texture(const std::string& path) {
+	TextureId load_texture_async(const std::string& path) {
 		auto maybe_tex = textures_map.find(path);
 		if (maybe_tex != textures_map.end()) {
 			DBGMSG("Texture was loaded earlier.");
-			return;
+			return maybe_tex->second;
 		}
-		auto sur = Surface(
-			[&](){
-				auto s = SDL_LoadBMP(path.data());
-				if (!s) throw std::runtime_error("Failed to load bmp.");
-				DBGMSG("bmp loaded:");
-				DBGMSG(path);
-				return s;
-			}(),
-			[](SDL_Surface* s) {
-				if (s) SDL_FreeSurface(s);
-			}
-		);
-		auto tex = create_texture(sur);
-		textures_map.emplace(path, std::move(tex));
-		DBGMSG("New texture loaded.");
+		if (!placeholder) {
+			placeholder = Texture(
+				[&](){
+					auto t = SDL_CreateTexture(
+						ren.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 2, 2
+					);
+					if (!t) SDL2_CORE_THROW("Failed to create placeholder texture.");
+					return t;
+				}(),
+				[](SDL_Texture* t) {
+					if (t) SDL_DestroyTexture(t);
+				}
+			);
+			const Uint32 pixels[4] {0xFFFF00FF, 0xFF000000, 0xFF000000, 0xFFFF00FF};
+			if (SDL_UpdateTexture(placeholder.get(), nullptr, pixels, 8))
+				SDL2_CORE_THROW("Failed to create placeholder texture.");
+		}
+		if (!loader)
+			loader.reset(new AsyncLoader(texture_format));
+		Uint32 index = acquire_slot();
+		auto& slot = textures[index];
+		slot.raw = placeholder.get();
+		slot.region = {0, 0, 2, 2};
+		slot.tex_w = 2;
+		slot.tex_h = 2;
+		slot.status = LoadStatus::Loading;
+		slot.name = path;
+		TextureId id {index, slot.generation};
+		textures_map.emplace(path, id);
+		loader->push({index, slot.generation, path});
+		DBGMSG("Texture load queued.");
+		return id;
 	}
 
-	/** Loads a vector of textures.
+	/** Starts loading a vector of textures on worker threads.
 	 * @param paths A vector of strings containing the paths to be used.
+	 * @return The handles of the textures in the order of paths.
+	 * @throws std::runtime_error on failure. */
+	std::vector<TextureId> load_texture_async(const std::vector<std::string>& paths) {
+		std::vector<TextureId> ids;
+		ids.reserve(paths.size());
+		for (const auto& path : paths)
+			ids.push_back(load_texture_async(path));
+		return ids;
+	}
+
+	/** Uploads textures decoded by the worker threads.
+	 * present() calls this with the limit set by set_async_uploads_per_frame.
+	 * @param max_uploads The maximum number of textures to upload.
+	 * @return The number of textures processed.
+	 * @throws std::runtime_error on failure. */
+	int process_async_loads(int max_uploads) {
+		int count = 0;
+		while (loader && count < max_uploads) {
+			auto result = loader->pop(false);
+			if (!result) break;
+			finish_async_load(*result);
+			count++;
+		}
+		return count;
+	}
+
+	/** Enables or disables hot reloading. While enabled, the bmps of the
+	 * textures loaded with load_texture and load_texture_async, atlas
+	 * regions included, are watched for changes. A changed bmp is decoded
+	 * on a worker thread and uploaded by present() into the texture it
+	 * was loaded into, so its handle stays valid. Atlas regions are
+	 * updated in place and have to keep their size.
+	 * @param enabled True to watch the bmps. */
+	void set_hot_reload(bool enabled) {
+		if (!enabled) {
+			watcher.reset();
+			return;
+		}
+		if (watcher)
+			return;
+		watcher.reset(new FileWatcher());
+		for (auto& slot : textures)
+			if (slot.from_bmp) watcher->add(slot.name);
+		DBGMSG("Hot reload enabled.");
+	}
+
+	/** Sets how many textures present() uploads per frame at most.
+	 * @param max_uploads The maximum number of uploads per frame. */
+	void set_async_uploads_per_frame(int max_uploads) {
+		async_uploads_per_frame = max_uploads;
+	}
+
+	/** Blocks until the specified texture is no longer loading, uploading
+	 * every texture that gets decoded meanwhile.
+	 * @param id The handle of the texture.
+	 * @return The final status of the texture.
 	 * @throws std::runtime_error on failure. */
-	void load_texture(const std::vector<std::string>& paths) {
-		for (auto path : paths) {
-			load_texture(path);
+	LoadStatus wait_for_texture(TextureId id) {
+		while (get_slot(id).status == LoadStatus::Loading) {
+			auto result = loader->pop(true);
+			if (!result) break;
+			finish_async_load(*result);
 		}
+		return get_slot(id).status;
+	}
+
+	/** Queries the state of a texture.
+	 * @param id The handle of the texture.
+	 * @return The status of the texture.
+	 * @throws std::runtime_error if the handle is invalid. */
+	LoadStatus texture_status(TextureId id) {
+		return get_slot(id).status;
+	}
+
+	/** Limits the memory used by textures. When it is exceeded, the least
+	 * recently drawn textures loaded from bmps with load_texture or
+	 * load_texture_async are evicted. Their handles stay valid and the
+	 * bmp is loaded again when they are drawn next. Atlas pages, layers,
+	 * text, streaming and asset pack textures are counted but never
+	 * evicted; use unload_texture for those.
+	 * @param bytes The budget in bytes. 0 means unlimited. */
+	void set_texture_budget(size_t bytes) {
+		texture_budget = bytes;
+		enforce_budget();
+	}
+
+	/** @return The estimated memory used by the loaded textures in bytes,
+	 * not counting evicted ones. */
+	size_t texture_memory() const {
+		size_t total = 0;
+		for (const auto& slot : textures)
+			if (slot.tex) total += slot.bytes;
+		return total;
+	}
+
+	/** Keeps a texture from being evicted, like one needed on the next
+	 * frame that shouldn't stall on a reload.
+	 * @param id The handle of the texture.
+	 * @param pinned False to allow evicting the texture again.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void pin_texture(TextureId id, bool pinned = true) {
+		get_slot(id).pinned = pinned;
+		if (!pinned)
+			enforce_budget();
 	}
 
 	/** Loads text for later use.
 	 * @param text The text to be rendered. 
 	 * @param col The color of the text.
+	 * @param pos The position of the top left corner of the text.
 	 * @param path_to_font Path to the .ttf font to be used. 
 	 * @param ptsize Size of the font as ptsize. 
-	 * @return A rect appropriately sized to fit the text.
+	 * @return The handle of the text's texture and a rect appropriately
+	 * sized to fit the text.
 	 * @throws std::runtime_error on failure. */
-	SDL_Rect load_text(
-		std::string text,
+	LoadedText load_text(
+		const std::string& text,
 		SDL_Color col,
 		SDL_Point pos,
-		std::string path_to_font,
+		const std::string& path_to_font,
 		int ptsize)
 	{
 		auto maybe_text = textures_map.find(text);
 		if (maybe_text != textures_map.end())
-			throw std::runtime_error("Text cannot be loaded twice.");
-		auto font = Font(
-			[&](){
-				auto f = TTF_OpenFont(path_to_font.data(), ptsize);
-				if (!f) throw std::runtime_error("Faield to load font.");
-				DBGMSG("Font opened.");
-				return f;
-			}(),
-			[](TTF_Font* f) {
-				if (f) TTF_CloseFont(f);
-			}
-		);
+			SDL2_CORE_THROW("Text cannot be loaded twice.");
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "load_text", text));
+		auto& font = get_font(load_font(path_to_font, ptsize)).font;
 		auto sur = Surface(
 			[&](){
 				auto s = TTF_RenderText_Blended(font.get(), text.data(), col);
-				if (!s) throw std::runtime_error("Failed to create text surface.");
+				if (!s) SDL2_CORE_THROW("Failed to create text surface.");
 				DBGMSG("Text surface created.");
 				return s;
 			}(),
@@ -254,73 +3720,1059 @@ public:
 		auto tex = create_texture(sur);
 		SDL_Rect rect = {pos.x, pos.y, 0, 0};
 		if (TTF_SizeText(font.get(), text.data(), &rect.w, &rect.h))
-			throw std::runtime_error("Failed to set text rect size.");
-		textures_map.emplace(text, std::move(tex));
+			SDL2_CORE_THROW("Failed to set text rect size.");
+		auto id = store_texture(text, std::move(tex));
 		DBGMSG("Text loaded.");
-		return rect;
+		return {id, rect};
+	}
+
+	/** Opens a font for use with draw_text and load_text. Fonts are cached
+	 * by path and ptsize, so calling this ahead of time preloads the font
+	 * and later calls with the same arguments cost a map lookup.
+	 * @param path_to_font Path to the .ttf font to be used.
+	 * @param ptsize Size of the font as ptsize.
+	 * @return The handle of the font. If the font was loaded earlier,
+	 * the existing handle is returned.
+	 * @throws std::runtime_error on failure. */
+	FontId load_font(const std::string& path_to_font, int ptsize) {
+		auto maybe_font = fonts_map.find({path_to_font, ptsize});
+		if (maybe_font != fonts_map.end()) {
+			DBGMSG("Font was loaded earlier.");
+			return maybe_font->second;
+		}
+		auto font = Font(
+			[&](){
+				auto f = TTF_OpenFont(path_to_font.data(), ptsize);
+				if (!f) SDL2_CORE_THROW("Faield to load font.");
+				DBGMSG("Font opened.");
+				return f;
+			}(),
+			[](TTF_Font* f) {
+				if (f) TTF_CloseFont(f);
+			}
+		);
+		Uint32 index;
+		if (free_fonts.empty()) {
+			fonts.emplace_back();
+			index = static_cast<Uint32>(fonts.size() - 1);
+		} else {
+			index = free_fonts.back();
+			free_fonts.pop_back();
+		}
+		auto& slot = fonts[index];
+		slot.line_skip = TTF_FontLineSkip(font.get());
+		slot.height = TTF_FontHeight(font.get());
+		slot.ascii.fill(-1);
+		slot.font = std::move(font);
+		slot.key = {path_to_font, ptsize};
+		FontId id {index, slot.generation};
+		fonts_map.emplace(slot.key, id);
+		DBGMSG("Font loaded.");
+		return id;
+	}
+
+	/** Closes a font and drops its cached glyphs. The handle and every
+	 * copy of it become invalid. Glyph pages are released once no font
+	 * is loaded.
+	 * @param id The handle of the font.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void evict_font(FontId id) {
+		auto& slot = get_font(id);
+		fonts_map.erase(slot.key);
+		slot.font.reset();
+		slot.key = {};
+		slot.glyphs.clear();
+		slot.other.clear();
+		slot.generation++;
+		free_fonts.push_back(id.index);
+		if (fonts_map.empty()) {
+			for (const auto& page : glyph_pages)
+				soft_mirrors.erase(page.tex.get());
+			glyph_pages.clear();
+		}
+		DBGMSG("Font evicted.");
+	}
+
+	/** Closes the font opened with the specified path and ptsize, if any.
+	 * @param path_to_font Path to the .ttf font.
+	 * @param ptsize Size of the font as ptsize. */
+	void evict_font(const std::string& path_to_font, int ptsize) {
+		auto maybe_font = fonts_map.find({path_to_font, ptsize});
+		if (maybe_font != fonts_map.end())
+			evict_font(maybe_font->second);
+	}
+
+	/** Looks up the handle of a texture by the path or text it was
+	 * loaded from.
+	 * @param name The path of the bmp or the text.
+	 * @return The handle or nullopt if no such texture is loaded. */
+	std::optional<TextureId> find_texture(const std::string& name) const {
+		auto maybe_tex = textures_map.find(name);
+		if (maybe_tex == textures_map.end())
+			return std::nullopt;
+		return maybe_tex->second;
+	}
+
+	/** Destroys a texture. The handle and every copy of it become invalid.
+	 * An atlas page is destroyed together with the last texture on it.
+	 * @param id The handle of the texture.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void unload_texture(TextureId id) {
+		auto& slot = get_slot(id);
+		auto page = slot.page;
+		release_slot(id.index);
+		if (page && --textures[*page].users == 0)
+			release_slot(*page);
+		DBGMSG("Texture unloaded.");
+	}
+
+	/** Creates a texture whose pixels are meant to change every frame,
+	 * like video frames or software rendered buffers. Its contents are
+	 * undefined until the first update.
+	 * @param w The width of the texture.
+	 * @param h The height of the texture.
+	 * @param format The pixel format of the texture.
+	 * @return The handle of the texture.
+	 * @throws std::runtime_error on failure. */
+	TextureId create_streaming_texture(
+		int w, int h, Uint32 format = SDL_PIXELFORMAT_ARGB8888)
+	{
+		auto tex = Texture(
+			[&](){
+				auto t = SDL_CreateTexture(
+					ren.get(), format, SDL_TEXTUREACCESS_STREAMING, w, h
+				);
+				if (!t) SDL2_CORE_THROW("Failed to create streaming texture.");
+				DBGMSG("Texture created.");
+				return t;
+			}(),
+			[](SDL_Texture* t) {
+				if (t) SDL_DestroyTexture(t);
+				DBGMSG("Texture destroyed.");
+			}
+		);
+		auto id = store_texture("", std::move(tex));
+		DBGMSG("Streaming texture created.");
+		return id;
+	}
+
+	/** Maps the pixels of a streaming texture for writing. The texture
+	 * must be unlocked before it is drawn.
+	 * @param id The handle of the texture.
+	 * @param rect The area to lock. If nullopt, the whole texture is locked.
+	 * @return The mapped pixels.
+	 * @throws std::runtime_error if the texture is not a streaming texture. */
+	LockedPixels lock_texture(TextureId id, const std::optional<SDL_Rect>& rect = std::nullopt) {
+		auto& slot = streaming_slot(id);
+		SDL_Rect area = rect.value_or(slot.region);
+		LockedPixels locked {nullptr, 0, area.w, area.h};
+		if (SDL_LockTexture(slot.raw, &area, &locked.pixels, &locked.pitch))
+			SDL2_CORE_THROW("Failed to lock texture.");
+		return locked;
+	}
+
+	/** Unmaps the pixels of a locked streaming texture and uploads them.
+	 * @param id The handle of the texture.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void unlock_texture(TextureId id) {
+		auto& slot = streaming_slot(id);
+		SDL_UnlockTexture(slot.raw);
+		soft_mirrors.erase(slot.raw);
+		full_redraw = true;
+		DBGMSG("Texture updated.");
+	}
+
+	/** Replaces pixels of a texture. Streaming textures are written
+	 * through their mapped memory, other textures and planar YUV
+	 * textures with SDL_UpdateTexture.
+	 * @param id The handle of the texture.
+	 * @param pixels The new pixels, in the format of the texture. Planar
+	 * YUV pixels hold the Y plane followed by the chroma planes, whose
+	 * rows are half as long, as SDL_UpdateTexture expects.
+	 * @param pitch The length of a row of the new pixels in bytes, or of
+	 * a row of the Y plane for planar YUV formats.
+	 * @param rect The area to update. If nullopt, the whole texture is
+	 * updated. An evicted texture is loaded again first.
+	 * @throws std::runtime_error on failure. */
+	void update_texture(
+		TextureId id, const void* pixels, int pitch,
+		const std::optional<SDL_Rect>& rect = std::nullopt)
+	{
+		auto& slot = writable_slot(id);
+		SDL_Rect area = rect.value_or(slot.region);
+		Uint32 format;
+		int access;
+		if (SDL_QueryTexture(slot.raw, &format, &access, nullptr, nullptr))
+			SDL2_CORE_THROW("Failed to query texture.");
+		if (access == SDL_TEXTUREACCESS_STREAMING && !planar_yuv(format)) {
+			void* dst;
+			int dst_pitch;
+			if (SDL_LockTexture(slot.raw, &area, &dst, &dst_pitch))
+				SDL2_CORE_THROW("Failed to lock texture.");
+			auto row = static_cast<size_t>(area.w) * SDL_BYTESPERPIXEL(format);
+			for (int y = 0; y < area.h; y++)
+				std::memcpy(
+					static_cast<Uint8*>(dst) + y * dst_pitch,
+					static_cast<const Uint8*>(pixels) + y * pitch,
+					row
+				);
+			SDL_UnlockTexture(slot.raw);
+		} else if (SDL_UpdateTexture(slot.raw, &area, pixels, pitch)) {
+			SDL2_CORE_THROW("Failed to update texture.");
+		}
+		// Reloading the bmp would undo the update, and the software
+		// rasterizer's copy is outdated.
+		slot.reloadable = false;
+		slot.from_bmp = false;
+		soft_mirrors.erase(slot.raw);
+		full_redraw = true;
+		DBGMSG("Texture updated.");
+	}
+
+	/** Uploads the latest frame published to a pixel stream, if there is
+	 * one that hasn't been uploaded yet.
+	 * @param id The handle of the texture. It must have the size of the
+	 * stream's frames.
+	 * @param stream The pixel stream.
+	 * @return True if a frame was uploaded.
+	 * @throws std::runtime_error on failure. */
+	bool update_texture(TextureId id, PixelStream& stream) {
+		// The frame is only taken from the stream once it can be uploaded.
+		auto& slot = writable_slot(id);
+		if (slot.region.w != stream.w || slot.region.h != stream.h)
+			SDL2_CORE_THROW("Pixel stream doesn't match texture.");
+		{
+			std::lock_guard lock(stream.mutex);
+			if (!stream.ready)
+				return false;
+			std::swap(stream.front, stream.upload);
+			stream.ready = false;
+		}
+		update_texture(id, stream.upload.data(), stream.row_pitch);
+		return true;
+	}
+
+	/** Creates an offscreen layer that can be drawn like any texture.
+	 * Static content, like backgrounds, tile maps or UI panels, is drawn
+	 * into the layer once and the layer is drawn every frame instead.
+	 * A new layer starts out dirty. Requires a renderer created with
+	 * SDL_RENDERER_TARGETTEXTURE.
+	 * @param w The width of the layer.
+	 * @param h The height of the layer.
+	 * @return The handle of the layer's texture.
+	 * @throws std::runtime_error on failure. */
+	TextureId create_layer(int w, int h) {
+		auto tex = Texture(
+			[&](){
+				auto t = SDL_CreateTexture(
+					ren.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h
+				);
+				if (!t) SDL2_CORE_THROW("Failed to create layer.");
+				DBGMSG("Texture created.");
+				return t;
+			}(),
+			[](SDL_Texture* t) {
+				if (t) SDL_DestroyTexture(t);
+				DBGMSG("Texture destroyed.");
+			}
+		);
+		if (SDL_SetTextureBlendMode(tex.get(), SDL_BLENDMODE_BLEND))
+			SDL2_CORE_THROW("Failed to set layer blend mode.");
+		auto id = store_texture("", std::move(tex));
+		auto& slot = textures[id.index];
+		slot.layer = true;
+		slot.dirty = true;
+		DBGMSG("Layer created.");
+		return id;
+	}
+
+	/** Starts redrawing a layer if it is dirty. When this returns true,
+	 * the layer has been cleared and made the render target, and the
+	 * draw functions render into it until end_layer() is called.
+	 * Commands in the frame's command buffer are not affected, since
+	 * they are submitted by present(); use submit() to draw a command
+	 * buffer into the layer. Layers can be nested.
+	 * @param id The handle of the layer.
+	 * @return True if the layer is dirty and has to be redrawn.
+	 * @throws std::runtime_error on failure. */
+	bool begin_layer(TextureId id) {
+		auto& slot = get_slot(id);
+		if (!slot.layer)
+			SDL2_CORE_THROW("Texture is not a layer.");
+		if (!slot.dirty) {
+			DBGMSG("Layer is up to date.");
+			return false;
+		}
+		SDL_Texture* previous = render_target;
+		set_target(slot.raw);
+		layer_stack.push_back({id.index, previous});
+		clear({0, 0, 0, 0});
+		DBGMSG("Layer started.");
+		return true;
+	}
+
+	/** Finishes the layer started by the matching begin_layer() call,
+	 * marks it clean and restores the previous render target.
+	 * @throws std::runtime_error on failure. */
+	void end_layer() {
+		if (layer_stack.empty())
+			SDL2_CORE_THROW("No layer was started.");
+		auto [index, previous] = layer_stack.back();
+		layer_stack.pop_back();
+		set_target(previous);
+		textures[index].dirty = false;
+		full_redraw = true;
+		DBGMSG("Layer finished.");
+	}
+
+	/** Marks a layer dirty so that the next begin_layer() redraws it.
+	 * @param id The handle of the layer.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void mark_layer_dirty(TextureId id) {
+		get_slot(id).dirty = true;
+	}
+
+	/** Marks every layer dirty. Call this on SDL_RENDER_TARGETS_RESET or
+	 * SDL_RENDER_DEVICE_RESET, after which the contents of render
+	 * targets are lost. */
+	void mark_all_layers_dirty() {
+		for (auto& slot : textures)
+			if (slot.layer) slot.dirty = true;
 	}
 
-	/** Sets the renderer's draw color.
+	/** Sets the renderer's draw color. Does nothing if it is already set,
+	 * since changing renderer state makes SDL flush its own batch.
 	 * @param col The color to be used.
 	 * @throws std::runtime_error on failure. */
 	void set_draw_color(SDL_Color col) {
-		if (SDL_SetRenderDrawColor(ren.get(), col.r, col.g, col.b, col.a))
-			throw std::runtime_error("Failed to set draw color.");
+		if (draw_color && same_color(*draw_color, col))
+			return;
+		if (SDL_SetRenderDrawColor(ren.get(), col.r, col.g, col.b, col.a)) {
+			draw_color.reset();
+			fail(Error::RenderFailed, "Failed to set draw color.");
+			return;
+		}
+		draw_color = col;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	/** Sets the blend mode of color fills. Does nothing if it is already
+	 * set. Textures keep their own blend mode.
+	 * @param mode The blend mode to be used.
+	 * @throws std::runtime_error on failure. */
+	void set_blend_mode(SDL_BlendMode mode) {
+		if (mode == draw_blend)
+			return;
+		if (SDL_SetRenderDrawBlendMode(ren.get(), mode))
+			SDL2_CORE_THROW("Failed to set blend mode.");
+		draw_blend = mode;
+		full_redraw = true;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	/** Restricts drawing to a rect of the viewport.
+	 * Partial redraw mode clips while it redraws and turns clipping off
+	 * afterwards.
+	 * @param rect The rect to draw in, relative to the viewport. If
+	 * nullopt, clipping is turned off.
+	 * @throws std::runtime_error on failure. */
+	void set_clip_rect(const std::optional<SDL_Rect>& rect) {
+		if (SDL_RenderSetClipRect(ren.get(), rect ? &*rect : nullptr))
+			SDL2_CORE_THROW("Failed to set clip rect.");
+		full_redraw = true;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	/** Sets the area of the target that is drawn into. Positions are
+	 * relative to its top left corner and draws are clipped to it.
+	 * @param rect The area, in coordinates multiplied by the scale, so
+	 * set the scale first. If nullopt, the whole target is used.
+	 * @throws std::runtime_error on failure. */
+	void set_viewport(const std::optional<SDL_Rect>& rect) {
+		if (SDL_RenderSetViewport(ren.get(), rect ? &*rect : nullptr))
+			SDL2_CORE_THROW("Failed to set viewport.");
+		full_redraw = true;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	/** Sets the factors positions and sizes are multiplied with.
+	 * @param x The horizontal factor.
+	 * @param y The vertical factor.
+	 * @throws std::runtime_error on failure. */
+	void set_scale(float x, float y) {
+		if (SDL_RenderSetScale(ren.get(), x, y))
+			SDL2_CORE_THROW("Failed to set scale.");
+		full_redraw = true;
+		SDL2_CORE_STATS(frame_stats.state_changes++);
+	}
+
+	/** Sets the color and alpha a texture is multiplied with when drawn.
+	 * Regions of an atlas have their own mod. Batched draws pass it to
+	 * SDL as vertex colors, so changing it doesn't break batches.
+	 * @param id The handle of the texture.
+	 * @param mod The color and alpha to multiply with, white for none.
+	 * @throws std::runtime_error if the handle is invalid. */
+	void set_texture_mod(TextureId id, SDL_Color mod) {
+		auto& slot = get_slot(id);
+		if (same_color(slot.mod, mod))
+			return;
+		slot.mod = mod;
+		full_redraw = true;
+	}
+
+	/** Like set_draw_color, for code built without exceptions.
+	 * @param col The color to be used.
+	 * @return Error::None on success. */
+	Error try_set_draw_color(SDL_Color col) noexcept {
+		return reporting_errors([&]() { set_draw_color(col); });
 	}
 
 	/** Clears the renderer with the specified color.
 	 * @param col The color to be used.
 	 * @throws std::runtime_error on failure. */
 	void clear(SDL_Color col) {
+		if (partial_redraw && layer_stack.empty()) {
+			if (
+				col.r != clear_color.r || col.g != clear_color.g ||
+				col.b != clear_color.b || col.a != clear_color.a
+			)
+				full_redraw = true;
+			clear_color = col;
+			return;
+		}
 		set_draw_color(col);
 		if (SDL_RenderClear(ren.get()))
-			throw std::runtime_error("Failed to clear renderer.");
+			fail(Error::RenderFailed, "Failed to clear renderer.");
+	}
+
+	/** Like clear, for code built without exceptions.
+	 * @param col The color to be used.
+	 * @return Error::None on success. */
+	Error try_clear(SDL_Color col) noexcept {
+		return reporting_errors([&]() { clear(col); });
 	}
 
 	/** Draws based on the specified renderer data.
 	 * @param data The renderer data to be used.
 	 * @throws std::runtime_error on failure. */
-	void draw(RenderData data) {
-		SDL_Rect *srcrect = data.srcrect.has_value() ? &data.srcrect.value() : nullptr;
-		SDL_Rect *dstrect = data.dstrect.has_value() ? &data.dstrect.value() : nullptr;
-		if (std::holds_alternative<std::string>(data.col_or_tex)) {
-			auto tex = textures_map.find(std::get<std::string>(data.col_or_tex));
-			if (tex == textures_map.end())
-				throw std::runtime_error("Failed to find texture.");
+	void draw(const RenderData& data) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		std::optional<SDL_Rect> view;
+		if (cull(data, view)) {
+			DBGMSG("Draw culled.");
+			return;
+		}
+		if (data.fdstrect.has_value() || !xform.identity()) {
+			Batch batch = begin_batch();
+			batch.culled_ahead = true;
+			batch_draw(batch, data);
+			flush_batch(batch.tex);
+			return;
+		}
+		const SDL_Rect *dstrect = data.dstrect.has_value() ? &data.dstrect.value() : nullptr;
+		if (std::holds_alternative<TextureId>(data.col_or_tex)) {
+			auto& slot = use_slot(std::get<TextureId>(data.col_or_tex));
+			SDL_Rect src = source_rect(slot, data.srcrect);
+			apply_mod(slot);
 			if (
 				SDL_RenderCopyEx(
 					ren.get(),
-					tex->second.get(),
-					srcrect,
+					slot.raw,
+					&src,
 					dstrect,
 					data.angle,
 					nullptr,
 					data.flip
 				)
-			)
-				throw std::runtime_error("Failed to render texture.");
+			) {
+				fail(Error::RenderFailed, "Failed to render texture.");
+				return;
+			}
+			SDL2_CORE_STATS(frame_stats.textures_bound++);
+			SDL2_CORE_STATS(frame_stats.draw_calls++);
+			SDL2_CORE_STATS(frame_stats.quads++);
 			DBGMSG("Texture rendered.");
 		} else {
 			SDL_Color col = std::get<SDL_Color>(data.col_or_tex);
 			set_draw_color(col);
-			if (SDL_RenderFillRect(ren.get(), dstrect))
-				throw std::runtime_error("Failed to fill rect.");
+			if (SDL_RenderFillRect(ren.get(), dstrect)) {
+				fail(Error::RenderFailed, "Failed to fill rect.");
+				return;
+			}
+			SDL2_CORE_STATS(frame_stats.draw_calls++);
+			SDL2_CORE_STATS(frame_stats.quads++);
 			DBGMSG("Rect rendered.");
 		}
 	}
 
+	/** Like draw, for code built without exceptions. Textures evicted by
+	 * the texture budget aren't reloaded.
+	 * @param data The renderer data to be used.
+	 * @return Error::None on success. */
+	Error try_draw(const RenderData& data) noexcept {
+		if (Error error = check_draw(data); error != Error::None)
+			return error;
+		return reporting_errors([&]() { draw(data); });
+	}
+
+	/** Like the vector overload of draw, for code built without
+	 * exceptions. The handles are checked before drawing, so nothing is
+	 * drawn if one is invalid or evicted.
+	 * @param data The vector of renderer data to be used.
+	 * @return Error::None on success. */
+	Error try_draw(const std::vector<RenderData>& data) noexcept {
+		return try_draw(data.data(), data.size());
+	}
+
+	/** Like the array overload of draw, for code built without exceptions.
+	 * The handles are checked before drawing, so nothing is drawn if one
+	 * is invalid or evicted.
+	 * @param data Pointer to the first element of the array.
+	 * @param count The number of elements.
+	 * @return Error::None on success. */
+	Error try_draw(const RenderData* data, size_t count) noexcept {
+		for (size_t i = 0; i < count; i++)
+			if (Error error = check_draw(data[i]); error != Error::None)
+				return error;
+		return reporting_errors([&]() { draw(data, count); });
+	}
+
 	/** Draws based on the specified vector of renderer data.
+	 * Consecutive items sharing a texture, as well as consecutive color
+	 * fills, are submitted together with a single SDL_RenderGeometry call.
 	 * @param data The vector of renderer data to be used.
 	 * @throws std::runtime_error on failure. */
-	void draw(std::vector<RenderData> data) {
-		for (auto d : data) {
-			draw(d);
+	void draw(const std::vector<RenderData>& data) {
+		draw(data.data(), data.size());
+	}
+
+	/** Draws based on the specified array of renderer data.
+	 * Works like the vector overload for data stored elsewhere.
+	 * @param data Pointer to the first element of the array.
+	 * @param count The number of elements.
+	 * @throws std::runtime_error on failure. */
+	void draw(const RenderData* data, size_t count) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		Batch batch = begin_batch();
+		if (culling) {
+			cull_draws(data, count, cull_view(), cull_mask);
+			batch.culled_ahead = true;
+			for (size_t i = 0; i < count; i++) {
+				if (!cull_mask[i]) {
+					SDL2_CORE_STATS(frame_stats.culled++);
+					continue;
+				}
+				batch_draw(batch, data[i]);
+			}
+		} else {
+			for (size_t i = 0; i < count; i++)
+				batch_draw(batch, data[i]);
+		}
+		flush_batch(batch.tex);
+	}
+
+	/** Draws the part of a static batch overlapping a view. The view is
+	 * a rect in the coordinates the draws were added in and its top left
+	 * corner is drawn at the top left of the target, so moving it scrolls
+	 * over the batch like a camera. Only the grid cells that can hold
+	 * visible draws are visited.
+	 * @param batch The static batch to be drawn.
+	 * @param view The part of the batch to be drawn.
+	 * @throws std::runtime_error on failure. */
+	void draw(StaticBatch& batch, const SDL_Rect& view) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		Batch state = begin_batch();
+		if (batch.count > 0 && view.w > 0 && view.h > 0) {
+			const int cx0 = std::max(batch.min_cx, batch.cell_of(view.x - batch.max_w + 1));
+			const int cy0 = std::max(batch.min_cy, batch.cell_of(view.y - batch.max_h + 1));
+			const int cx1 = std::min(batch.max_cx, batch.cell_of(view.x + view.w - 1));
+			const int cy1 = std::min(batch.max_cy, batch.cell_of(view.y + view.h - 1));
+			const float dx = -static_cast<float>(view.x);
+			const float dy = -static_cast<float>(view.y);
+			for (int cy = cy0; cy <= cy1; cy++) {
+				for (int cx = cx0; cx <= cx1; cx++) {
+					auto it = batch.cells.find(StaticBatch::key(cx, cy));
+					if (it == batch.cells.end())
+						continue;
+					StaticBatch::Cell& cell = it->second;
+					if (!cell.built || !cell_current(cell))
+						build_cell(cell);
+					const SDL_Vertex* vertices = cell.vertices.data();
+					for (const auto& run : cell.runs) {
+						TextureSlot* slot = run.textured ? &use_slot(run.id) : nullptr;
+						bind_batch(state, slot ? slot->raw : nullptr);
+						append_quads(vertices, run.quads, dx, dy, slot ? slot->mod : SDL_Color{255, 255, 255, 255});
+						vertices += run.quads * 4;
+					}
+				}
+			}
+		}
+		flush_batch(state.tex);
+		DBGMSG("Static batch rendered.");
+	}
+
+	/** Draws many copies of a texture in one batch, like particles. The
+	 * vertices are written straight from the instance arrays, without
+	 * going through RenderData.
+	 * @param id The handle of the texture.
+	 * @param instances The positions, sizes, angles and colors.
+	 * @param srcrect The part of the texture to draw. If nullopt, the
+	 * whole texture is drawn.
+	 * @throws std::runtime_error on failure. */
+	void draw_instanced(
+		TextureId id, const Instances& instances,
+		const std::optional<SDL_Rect>& srcrect = std::nullopt)
+	{
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		const size_t n = instances.size();
+		if (
+			instances.y.size() != n || instances.w.size() != n || instances.h.size() != n ||
+			(!instances.angle.empty() && instances.angle.size() != n) ||
+			(!instances.color.empty() && instances.color.size() != n)
+		)
+			SDL2_CORE_THROW("Instance arrays differ in size.");
+		auto& slot = use_slot(id);
+		Batch batch = begin_batch();
+		bind_batch(batch, slot.raw);
+		SDL_Rect src = source_rect(slot, srcrect);
+		const float tw = static_cast<float>(slot.tex_w);
+		const float th = static_cast<float>(slot.tex_h);
+		const float u0 = static_cast<float>(src.x) / tw;
+		const float v0 = static_cast<float>(src.y) / th;
+		const float u1 = static_cast<float>(src.x + src.w) / tw;
+		const float v1 = static_cast<float>(src.y + src.h) / th;
+		const float* px = instances.x.data();
+		const float* py = instances.y.data();
+		const float* pw = instances.w.data();
+		const float* ph = instances.h.data();
+		const float* pa = instances.angle.empty() ? nullptr : instances.angle.data();
+		const SDL_Color* pc = instances.color.empty() ? nullptr : instances.color.data();
+		const float to_rad = static_cast<float>(M_PI) / 180.0f;
+		const Transform* t = active_transform();
+		const bool tinted = !same_color(slot.mod, {255, 255, 255, 255});
+		batch_vertices.resize(n * 4);
+		batch_indices.resize(n * 6);
+		SDL_Vertex* vertex = batch_vertices.data();
+		int* index = batch_indices.data();
+		for (size_t i = 0; i < n; i++) {
+			// The half extents along the rotated x and y axes.
+			float c = 1.0f, s = 0.0f;
+			if (pa && pa[i] != 0.0f) {
+				c = std::cos(pa[i] * to_rad);
+				s = std::sin(pa[i] * to_rad);
+			}
+			float ax = pw[i] * 0.5f * c, ay = pw[i] * 0.5f * s;
+			float bx = -ph[i] * 0.5f * s, by = ph[i] * 0.5f * c;
+			SDL_Color col = pc ? (tinted ? modulate(pc[i], slot.mod) : pc[i]) : slot.mod;
+			SDL_Vertex* v = vertex + i * 4;
+			v[0] = {{px[i] - ax - bx, py[i] - ay - by}, col, {u0, v0}};
+			v[1] = {{px[i] + ax - bx, py[i] + ay - by}, col, {u1, v0}};
+			v[2] = {{px[i] + ax + bx, py[i] + ay + by}, col, {u1, v1}};
+			v[3] = {{px[i] - ax + bx, py[i] - ay + by}, col, {u0, v1}};
+			if (t)
+				for (int k = 0; k < 4; k++)
+					v[k].position = t->apply(v[k].position);
+			int base = static_cast<int>(i * 4);
+			int* q = index + i * 6;
+			q[0] = base;
+			q[1] = base + 1;
+			q[2] = base + 2;
+			q[3] = base;
+			q[4] = base + 2;
+			q[5] = base + 3;
+		}
+		flush_batch(batch.tex);
+		DBGMSG("Instances rendered.");
+	}
+
+	/** Draws text from the glyph cache of the font. Glyphs are rasterized
+	 * the first time they are used and drawn as batched quads, so the text
+	 * and its color can change every frame without creating textures.
+	 * Newlines start a new line.
+	 * @param text The UTF-8 text to be drawn.
+	 * @param pos The position of the top left corner of the text.
+	 * @param col The color of the text.
+	 * @param font The handle of the font to be used.
+	 * @return The rect covered by the text.
+	 * @throws std::runtime_error on failure. */
+	SDL_Rect draw_text(std::string_view text, SDL_Point pos, SDL_Color col, FontId font) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		Batch batch = begin_batch();
+		SDL_Rect bounds = batch_text(batch, text, pos, col, font);
+		flush_batch(batch.tex);
+		return bounds;
+	}
+
+	/** Calculates the rect text would cover if drawn with draw_text.
+	 * @param text The UTF-8 text to be measured.
+	 * @param pos The position of the top left corner of the text.
+	 * @param font The handle of the font to be used.
+	 * @return The rect covered by the text.
+	 * @throws std::runtime_error on failure. */
+	SDL_Rect measure_text(std::string_view text, SDL_Point pos, FontId font) {
+		return layout_text(get_font(font), text, pos, [](const Glyph&, int, int) {});
+	}
+
+	/** Returns the command buffer of the current frame. Commands recorded
+	 * into it are submitted by present(), after which it is reset.
+	 * @return The frame's command buffer. */
+	CommandBuffer& command_buffer() {
+		return frame_commands;
+	}
+
+	/** Draws the commands of a command buffer in the order they were
+	 * recorded. Consecutive commands are batched the same way the vector
+	 * overload of draw batches. The buffer is left untouched.
+	 * @param commands The command buffer to be drawn.
+	 * @throws std::runtime_error on failure. */
+	void submit(const CommandBuffer& commands) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		submit_commands(commands);
+		DBGMSG("Command buffer submitted.");
+	}
+
+	/** Submits command buffers recorded concurrently, one per worker
+	 * thread, as if they were one buffer holding their commands in turn.
+	 * Buffers with sorting enabled are sorted on their own. Textures are
+	 * looked up on the calling thread, while the vertices of long runs of
+	 * quads sharing a texture are built on a pool of worker threads.
+	 * @param lists The command buffers in the order they are drawn.
+	 * @throws std::runtime_error on failure. */
+	void submit(const std::vector<const CommandBuffer*>& lists) {
+		SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+		begin_batch();
+		pending_quads.clear();
+		std::optional<SDL_Rect> target;
+		std::optional<SDL_Rect> view;
+		SDL_Texture* run_tex = nullptr;
+		auto visit = [&](const CommandBuffer::Command* cmd) {
+			if (cmd->type == CommandBuffer::Type::Text) {
+				flush_quads(run_tex);
+				auto text = static_cast<const CommandBuffer::TextCommand*>(cmd);
+				Batch batch = begin_batch();
+				batch_text(batch, {text->text, text->length}, text->pos, text->col, text->font);
+				flush_batch(batch.tex);
+				run_tex = nullptr;
+				return;
+			}
+			const auto& data = static_cast<const CommandBuffer::DrawCommand*>(cmd)->data;
+			if (cull(data, view))
+				return;
+			SDL_Texture* tex;
+			Quad q = resolve_draw(data, target, tex);
+			if (tex != run_tex) {
+				SDL2_CORE_STATS(if (!pending_quads.empty()) frame_stats.batch_breaks++);
+				SDL2_CORE_STATS(if (tex) frame_stats.textures_bound++);
+				flush_quads(run_tex);
+				run_tex = tex;
+			}
+			pending_quads.push_back(q);
+		};
+		for (auto list : lists) {
+			if (list->sorting) {
+				sort_items.clear();
+				Uint32 index = 0;
+				for (auto cmd = list->head; cmd; cmd = cmd->next, index++)
+					sort_items.push_back({sort_key(cmd), cmd, index});
+				radix_sort(sort_items, sort_scratch);
+				for (const auto& item : sort_items)
+					visit(item.cmd);
+			} else {
+				for (auto cmd = list->head; cmd; cmd = cmd->next)
+					visit(cmd);
+			}
 		}
+		flush_quads(run_tex);
+		DBGMSG("Command lists submitted.");
+	}
+
+	/** Enables or disables culling. When enabled, draws whose dstrect,
+	 * expanded to cover its rotation, lies entirely outside the viewport
+	 * and clip rect of the current target are skipped before any vertices
+	 * are built. Stats::culled counts them.
+	 * @param enabled True to cull. */
+	void set_culling(bool enabled) {
+		culling = enabled;
+	}
+
+	/** Saves the current transform on the transform stack. */
+	void push_transform() {
+		transform_stack.push_back(xform);
+	}
+
+	/** Restores the transform saved by the matching push_transform.
+	 * @throws std::runtime_error if the stack is empty. */
+	void pop_transform() {
+		if (transform_stack.empty())
+			SDL2_CORE_THROW("Transform stack is empty.");
+		xform = transform_stack.back();
+		transform_stack.pop_back();
+	}
+
+	/** Replaces the current transform. The transform maps the dstrects of
+	 * draws, text, instances and static batches to the target while their
+	 * vertices are built, so what is drawn can be moved, scaled and
+	 * rotated without rounding to integer rects. Draws without a dstrect
+	 * still cover the whole target. Culling and partial redraws take the
+	 * transform into account. The frame's command buffer is drawn with
+	 * the transform current when present() is called.
+	 * @param transform The new transform. */
+	void set_transform(const Transform& transform) {
+		xform = transform;
+	}
+
+	/** @return The current transform. */
+	const Transform& transform() const {
+		return xform;
+	}
+
+	/** Moves what is drawn next, in the units of the current transform.
+	 * @param x The horizontal offset.
+	 * @param y The vertical offset. */
+	void translate(float x, float y) {
+		xform.tx += xform.a * x + xform.c * y;
+		xform.ty += xform.b * x + xform.d * y;
+	}
+
+	/** Scales what is drawn next around the current origin.
+	 * @param x The horizontal factor.
+	 * @param y The vertical factor. */
+	void scale(float x, float y) {
+		xform.a *= x;
+		xform.b *= x;
+		xform.c *= y;
+		xform.d *= y;
+	}
+
+	/** Rotates what is drawn next around the current origin.
+	 * @param angle The angle in degrees, clockwise like RenderData::angle. */
+	void rotate(float angle) {
+		float rad = angle * static_cast<float>(M_PI) / 180.0f;
+		float c = std::cos(rad), s = std::sin(rad);
+		Transform t = xform;
+		xform.a = t.a * c + t.c * s;
+		xform.b = t.b * c + t.d * s;
+		xform.c = t.c * c - t.a * s;
+		xform.d = t.d * c - t.b * s;
 	}
 
-	/** Presents the rendered objects. */
+	/** Replaces the current transform with a camera looking at a point.
+	 * The point is drawn at the center of the current target.
+	 * @param center The point to look at.
+	 * @param zoom The scale of what is drawn.
+	 * @param angle The rotation of the camera in degrees. What is drawn
+	 * turns the other way. */
+	void set_camera(SDL_FPoint center, float zoom = 1.0f, float angle = 0.0f) {
+		SDL_Rect viewport;
+		SDL_RenderGetViewport(ren.get(), &viewport);
+		xform = {};
+		translate(static_cast<float>(viewport.w) * 0.5f, static_cast<float>(viewport.h) * 0.5f);
+		rotate(-angle);
+		scale(zoom, zoom);
+		translate(-center.x, -center.y);
+	}
+
+	/** Submits the newest frame published to a frame queue, or the
+	 * previous one again if no new frame was published since.
+	 * @param queue The frame queue.
+	 * @throws std::runtime_error on failure. */
+	void submit(FrameQueue& queue) {
+		submit(queue.acquire());
+	}
+
+	/** Submits the frame's command buffer, presents the rendered objects
+	 * and uploads textures finished by the async loader. Ends the frame
+	 * the statistics returned by stats() are collected for.
+	 * @throws std::runtime_error on failure. */
 	void present() {
-		SDL_RenderPresent(ren.get());
+		SDL2_CORE_STATS(ProfileZone zone(profiler.get(), "present"));
+		bool changed = true;
+		if (partial_redraw && layer_stack.empty()) {
+			SDL2_CORE_STATS(PhaseTimer timer(draw_ticks));
+			changed = present_partial();
+		} else if (!frame_commands.empty()) {
+			submit(frame_commands);
+			frame_commands.reset();
+		}
+		if (pace_period) {
+			SDL2_CORE_STATS(ProfileZone pace_zone(profiler.get(), "pace"));
+			SDL2_CORE_STATS(Uint64 wait_start = SDL_GetPerformanceCounter());
+			pace_frame();
+			SDL2_CORE_STATS(frame_stats.wait_ms = static_cast<double>(
+				SDL_GetPerformanceCounter() - wait_start) * 1000.0 /
+				static_cast<double>(SDL_GetPerformanceFrequency()));
+			SDL2_CORE_STATS(frame_stats.frame_rate = static_cast<double>(
+				SDL_GetPerformanceFrequency()) / static_cast<double>(pace_period * pace_divisor));
+		}
+		{
+			SDL2_CORE_STATS(PhaseTimer timer(present_ticks));
+			if (changed)
+				SDL_RenderPresent(ren.get());
+			frame_start = SDL_GetPerformanceCounter();
+			SDL2_CORE_STATS(if (input_tick) frame_stats.input_latency_ms = static_cast<double>(
+				frame_start - input_tick) * 1000.0 / static_cast<double>(SDL_GetPerformanceFrequency()));
+			input_tick = 0;
+			frame_index++;
+			if (profiler)
+				profiler->frame.store(frame_index, std::memory_order_relaxed);
+			if (watcher)
+				queue_hot_reloads();
+			process_async_loads(async_uploads_per_frame);
+		}
+		SDL2_CORE_STATS(end_frame_stats());
+	}
+
+	/** Paces present() to a frame rate. present() waits until the next
+	 * frame is due, sleeping with SDL_Delay and spinning on
+	 * SDL_GetPerformanceCounter for the last two milliseconds. Frames that
+	 * run late by more than a frame are presented right away and the
+	 * schedule restarts from them, instead of catching up with a burst.
+	 * Pace a renderer created without SDL_RENDERER_PRESENTVSYNC, or pick
+	 * a rate that divides the refresh rate of the display.
+	 * @param fps The target frame rate. 0 turns pacing off.
+	 * @param adaptive If true, the rate is halved, down to a quarter,
+	 * when frames keep missing it, so that frame times stay even under
+	 * load. It goes back up once frames are fast enough again. */
+	void set_frame_rate(double fps, bool adaptive = false) {
+		pace_period = fps > 0.0 ? static_cast<Uint64>(
+			static_cast<double>(SDL_GetPerformanceFrequency()) / fps) : 0;
+		pace_deadline = 0;
+		pace_divisor = 1;
+		adaptive_pacing = adaptive;
+		frames_late = 0;
+		frames_early = 0;
+	}
+
+	/** Marks the time input was read, like after SDL_PollEvent returned
+	 * an event. The time from the first mark of a frame until the frame
+	 * is presented is reported as Stats::input_latency_ms. */
+	void mark_input() {
+		if (!input_tick)
+			input_tick = SDL_GetPerformanceCounter();
+	}
+
+	/** Enables or disables profiling. While it is enabled, load_texture,
+	 * load_text, create_texture, async uploads, vertex building on the
+	 * worker pool, each batch flush and present are recorded as zones
+	 * with their start and end time, thread and frame into a ring buffer
+	 * that holds the most recent ones. Zones are not recorded when the
+	 * library is built with SDL2_CORE_NO_STATS.
+	 * @param capacity The number of zones to keep, rounded up to a power
+	 * of two. 0 turns profiling off and drops the recorded zones. */
+	void set_profiling(size_t capacity) {
+		if (!capacity) {
+			profiler.reset();
+			return;
+		}
+		profiler.reset(new Profiler(capacity, frame_index));
+		DBGMSG("Profiling enabled.");
+	}
+
+	/** Formats the zones of recent frames as Chrome trace event JSON,
+	 * which chrome://tracing and Perfetto open. Times are in
+	 * microseconds from the first zone. The detail of a zone, like the
+	 * path of a texture, is cut to 40 bytes.
+	 * @param frames The number of presented frames to include, besides
+	 * the zones recorded since the last present.
+	 * @return The JSON document. It has no events if profiling is off. */
+	std::string profile_trace(size_t frames) const {
+		std::string out = "{\"traceEvents\":[";
+		if (profiler) {
+			Uint64 now = profiler->frame.load(std::memory_order_relaxed);
+			auto zones = profiler->snapshot(now > frames ? now - frames : 0);
+			const double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+			auto escape = [&](std::string_view text) {
+				for (char c : text) {
+					if (c == '"' || c == '\\') {
+						out += '\\';
+						out += c;
+					} else if (static_cast<unsigned char>(c) < 0x20) {
+						char code[8];
+						std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+						out += code;
+					} else {
+						out += c;
+					}
+				}
+			};
+			for (size_t i = 0; i < zones.size(); i++) {
+				const auto& z = zones[i];
+				char times[64];
+				std::snprintf(
+					times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f,",
+					static_cast<double>(z.start - zones[0].start) * 1e6 / freq,
+					static_cast<double>(z.end - z.start) * 1e6 / freq
+				);
+				out += i ? ",{\"name\":\"" : "{\"name\":\"";
+				escape(z.name);
+				out += "\",\"cat\":\"sdl2_core\",\"ph\":\"X\",";
+				out += times;
+				out += "\"pid\":0,\"tid\":" + std::to_string(z.thread);
+				out += ",\"args\":{\"frame\":" + std::to_string(z.frame);
+				if (z.count)
+					out += ",\"count\":" + std::to_string(z.count);
+				if (!z.detail.empty()) {
+					out += ",\"detail\":\"";
+					escape(z.detail);
+					out += '"';
+				}
+				out += "}}";
+			}
+		}
+		out += "]}";
+		return out;
+	}
+
+	/** Writes the zones of recent frames to a file as Chrome trace event
+	 * JSON. See profile_trace.
+	 * @param path The path of the file.
+	 * @param frames The number of presented frames to include.
+	 * @throws std::runtime_error on failure. */
+	void save_profile_trace(const std::string& path, size_t frames) const {
+		auto trace = profile_trace(frames);
+		auto rw = SDL_RWFromFile(path.c_str(), "wb");
+		if (!rw) SDL2_CORE_THROW("Failed to open profile trace.");
+		bool written = SDL_RWwrite(rw, trace.data(), trace.size(), 1) == 1;
+		if (SDL_RWclose(rw) || !written)
+			SDL2_CORE_THROW("Failed to write profile trace.");
+		DBGMSG("Profile trace saved.");
+	}
+
+	/** Enables or disables partial redraw mode. In this mode the frame's
+	 * command buffer is drawn into a persistent canvas and compared with
+	 * the previous frame's. Only the area covered by commands that were
+	 * added, removed or changed is cleared and redrawn, and present skips
+	 * SDL_RenderPresent entirely when nothing changed. clear() outside of
+	 * a layer only records the clear color. Draws that bypass the
+	 * command buffer are overwritten by the canvas. Requires a renderer
+	 * created with SDL_RENDERER_TARGETTEXTURE.
+	 * @param enabled True to enable the mode. */
+	void set_partial_redraw(bool enabled) {
+		partial_redraw = enabled;
+		full_redraw = true;
+		prev_signatures.clear();
+		prev_bounds.clear();
+		if (!enabled)
+			canvas.reset();
+	}
+
+	/** Forces the next partial redraw to redraw the whole canvas, like
+	 * after changing the contents of a texture that is on screen. */
+	void invalidate() {
+		full_redraw = true;
+	}
+
+	/** Forces the next partial redraw to redraw an area.
+	 * @param rect The area to be redrawn. */
+	void invalidate(const SDL_Rect& rect) {
+		add_dirty(pending_dirty, rect);
+	}
+
+	/** Returns the statistics of the last presented frame. When compiled
+	 * with SDL2_CORE_NO_STATS, every counter stays zero.
+	 * @return The statistics. */
+	const Stats& stats() const {
+		return last_stats;
 	}
 };
 
@@ -1,20 +1,148 @@
 #include "SDL2_core.hpp"
 #include <ctest.h>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace SDL2_Core;
 
 int main(void) {
 	try {
-	Sdl sdl("test", 800, 600);
+	{
+		Sdl legacy("test", 800, 600);
+		CTEST(dbg_msg == "Renderer created.");
+		CTEST(legacy.framebuffer() == nullptr);
+	}
+
+	{
+		Sdl::Config soft_config;
+		soft_config.window_flags = SDL_WINDOW_HIDDEN;
+		soft_config.software_renderer = true;
+		Sdl soft("test", 64, 48, soft_config);
+		const SDL_Surface* fb = soft.framebuffer();
+		CTEST(fb && fb->format->format == SDL_PIXELFORMAT_ARGB8888);
+		auto pixel = [&](int x, int y) {
+			return static_cast<const Uint32*>(fb->pixels)[y * fb->pitch / 4 + x];
+		};
+		auto near = [](Uint32 a, Uint32 b) {
+			for (int shift = 0; shift < 24; shift += 8) {
+				int d = static_cast<int>((a >> shift) & 0xFF) - static_cast<int>((b >> shift) & 0xFF);
+				if (d < -1 || d > 1) return false;
+			}
+			return true;
+		};
+		// Compares a 16x16 area, magnified by zoom, with a bmp drawn
+		// over black.
+		auto matches_bmp = [&](const char* path, int x0, int y0, int zoom) {
+			SDL_Surface* bmp = SDL_LoadBMP(path);
+			SDL_Surface* texels = bmp ? SDL_ConvertSurfaceFormat(bmp, SDL_PIXELFORMAT_ARGB8888, 0) : nullptr;
+			bool same = texels && texels->w == 16 && texels->h == 16;
+			for (int y = 0; same && y < 16; y++) {
+				for (int x = 0; same && x < 16; x++) {
+					Uint32 t = static_cast<const Uint32*>(texels->pixels)[y / zoom * texels->pitch / 4 + x / zoom];
+					Uint32 a = t >> 24, expected = 0;
+					for (int shift = 0; shift < 24; shift += 8)
+						expected |= (((t >> shift) & 0xFF) * a / 255) << shift;
+					same = near(pixel(x0 + x, y0 + y), expected);
+				}
+			}
+			SDL_FreeSurface(texels);
+			SDL_FreeSurface(bmp);
+			return same;
+		};
+		auto fill = [&](SDL_Rect rect, SDL_Color col) {
+			Sdl::RenderData d;
+			d.dstrect = rect;
+			d.col_or_tex = col;
+			soft.draw(std::vector<Sdl::RenderData>{d});
+		};
+
+		// Spans both raster bands, with the right and bottom edges excluded.
+		fill({4, 4, 8, 36}, {255, 0, 0, 255});
+		soft.set_blend_mode(SDL_BLENDMODE_BLEND);
+		fill({8, 8, 8, 8}, {0, 0, 255, 128});
+		soft.set_blend_mode(SDL_BLENDMODE_NONE);
+
+		auto face_tex = soft.load_texture("../assets/face.bmp");
+		Sdl::RenderData sprite;
+		sprite.dstrect = SDL_Rect{40, 4, 16, 16};
+		sprite.col_or_tex = face_tex;
+		soft.draw(std::vector<Sdl::RenderData>{sprite});
+
+		soft.set_clip_rect(SDL_Rect{40, 24, 8, 8});
+		fill({32, 20, 32, 28}, {0, 255, 0, 255});
+		soft.set_clip_rect(std::nullopt);
+
+		soft.set_scale(2.0f, 2.0f);
+		soft.set_viewport(SDL_Rect{8, 16, 8, 8});
+		fill({1, 1, 2, 2}, {255, 255, 0, 255});
+		fill({6, 6, 10, 10}, {255, 255, 0, 255});
+		soft.set_scale(1.0f, 1.0f);
+		soft.set_viewport(std::nullopt);
+		soft.present();
+
+		const Uint32 red = 0xFFFF0000, green = 0xFF00FF00, yellow = 0xFFFFFF00;
+		CTEST(pixel(4, 4) == red && pixel(11, 39) == red && pixel(4, 32) == red && pixel(11, 4) == red);
+		CTEST(pixel(3, 4) == 0 && pixel(12, 20) == 0 && pixel(4, 40) == 0 && pixel(4, 3) == 0);
+		CTEST(near(pixel(8, 8), 0xFF7F0080) && near(pixel(11, 15), 0xFF7F0080));
+		CTEST(near(pixel(12, 8), 0x00000080) && near(pixel(15, 15), 0x00000080));
+		CTEST(pixel(16, 8) == 0 && pixel(12, 16) == 0);
+
+		CTEST(matches_bmp("../assets/face.bmp", 40, 4, 1));
+
+		CTEST(pixel(40, 24) == green && pixel(47, 31) == green);
+		CTEST(pixel(39, 24) == 0 && pixel(48, 31) == 0 && pixel(40, 23) == 0 && pixel(40, 32) == 0);
+
+		CTEST(pixel(18, 34) == yellow && pixel(21, 37) == yellow);
+		CTEST(pixel(17, 34) == 0 && pixel(22, 37) == 0 && pixel(18, 33) == 0 && pixel(18, 38) == 0);
+		CTEST(pixel(28, 44) == yellow && pixel(31, 47) == yellow && pixel(32, 47) == 0 && pixel(27, 44) == 0);
+
+		// Built over the async placeholder first, then redrawn once the
+		// texture is loaded.
+		Sdl::StaticBatch tiles(32);
+		Sdl::RenderData tile;
+		tile.dstrect = SDL_Rect{0, 0, 16, 16};
+		tile.srcrect = SDL_Rect{0, 0, 8, 8};
+		tile.col_or_tex = soft.load_texture_async("../assets/face2.bmp");
+		tiles.add(tile);
+		soft.set_clip_rect(SDL_Rect{0, 0, 1, 1});
+		soft.draw(tiles, {-40, -32, 64, 48});
+		soft.set_clip_rect(std::nullopt);
+		CTEST(soft.wait_for_texture(std::get<Sdl::TextureId>(tile.col_or_tex)) == Sdl::LoadStatus::Ready);
+		soft.draw(tiles, {-40, -32, 64, 48});
+		soft.present();
+		CTEST(matches_bmp("../assets/face2.bmp", 40, 32, 2));
+
+		Sdl::RenderData unflushed;
+		unflushed.dstrect = SDL_Rect{56, 40, 4, 4};
+		fail_next_flush = true;
+		CTEST(soft.try_draw(std::vector<Sdl::RenderData>{unflushed}) == Sdl::Error::RenderFailed);
+		fail_next_flush = true;
+		bool flush_failed = false;
+		try {
+			soft.draw(std::vector<Sdl::RenderData>{unflushed});
+		} catch (const std::runtime_error&) {
+			flush_failed = true;
+		}
+		CTEST(flush_failed);
+		CTEST(pixel(56, 40) == 0);
+	}
+
+	Sdl::Config config;
+	config.init_flags = SDL_INIT_VIDEO;
+	config.window_flags = SDL_WINDOW_HIDDEN;
+	config.renderer_flags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE;
+	Sdl sdl("test", 800, 600, config);
 	CTEST(dbg_msg == "Renderer created.");
 
-	sdl.load_texture("../assets/face.bmp");
+	auto face = sdl.load_texture("../assets/face.bmp");
 	CTEST(dbg_msg == "New texture loaded.");
 
-	sdl.load_texture("../assets/face.bmp");
+	CTEST(sdl.load_texture("../assets/face.bmp") == face);
 	CTEST(dbg_msg == "Texture was loaded earlier.");
 
 	std::vector<std::string> paths;
@@ -22,12 +150,14 @@ int main(void) {
 	paths.push_back("../assets/face2.bmp");
 	paths.push_back("../assets/face3.bmp");
 
-	sdl.load_texture(paths);
+	auto ids = sdl.load_texture(paths);
 	CTEST(dbg_msg == "New texture loaded.");
+	CTEST(ids.size() == 2);
+	CTEST(sdl.find_texture("../assets/face2.bmp") == ids[0]);
 
 	Sdl::RenderData data;
 	data.dstrect = SDL_Rect{0, 0, 50, 50};
-	data.col_or_tex = "../assets/face2.bmp";
+	data.col_or_tex = ids[0];
 
 	sdl.draw(data);
 	CTEST(dbg_msg == "Texture rendered.");
@@ -37,18 +167,541 @@ int main(void) {
 	sdl.draw(data);
 	CTEST(dbg_msg == "Rect rendered.");
 
-	SDL_Rect text_rect =
+	std::vector<Sdl::RenderData> batch(3, data);
+	batch[1].col_or_tex = ids[1];
+	batch[1].angle = 45.0f;
+	batch[1].flip = SDL_FLIP_HORIZONTAL;
+	batch[2].col_or_tex = ids[1];
+	batch[2].dstrect = std::nullopt;
+
+	sdl.draw(batch);
+	CTEST(dbg_msg == "Batch rendered.");
+
+	const Sdl::RenderData fixed[2] {batch[0], batch[1]};
+	sdl.draw(fixed, 2);
+	CTEST(dbg_msg == "Batch rendered.");
+
+
+	auto text =
 		sdl.load_text(
 			"some text", {100, 100, 100, 255}, {0, 0}, "../MononokiNerdFont-Regular.ttf", 99
 	);
 	CTEST(dbg_msg == "Text loaded.");
 
-	data.col_or_tex = "some text";
-	data.dstrect = text_rect;
+	data.col_or_tex = text.id;
+	data.dstrect = text.rect;
+
+	sdl.draw(data);
+	CTEST(dbg_msg == "Texture rendered.");
+
+	sdl.unload_texture(text.id);
+	CTEST(dbg_msg == "Texture unloaded.");
+	CTEST(!sdl.find_texture("some text").has_value());
+
+	bool stale_handle_rejected = false;
+	try {
+		sdl.draw(data);
+	} catch (const std::runtime_error&) {
+		stale_handle_rejected = true;
+	}
+	CTEST(stale_handle_rejected);
+
+	auto reused = sdl.load_text(
+		"other text", {100, 100, 100, 255}, {0, 0}, "../MononokiNerdFont-Regular.ttf", 99
+	);
+	CTEST(reused.id.index == text.id.index);
+	CTEST(reused.id != text.id);
+
+	sdl.unload_texture(face);
+	sdl.unload_texture(ids[0]);
+	sdl.unload_texture(ids[1]);
+	std::vector<std::string> atlas_paths {
+		"../assets/face.bmp", "../assets/face2.bmp", "../assets/face3.bmp"
+	};
+	auto atlas_ids = sdl.load_texture(atlas_paths, true);
+	CTEST(dbg_msg == "Atlas loaded.");
+	CTEST(atlas_ids.size() == 3);
+	CTEST(atlas_ids[0] != atlas_ids[1]);
+	CTEST(sdl.find_texture("../assets/face3.bmp") == atlas_ids[2]);
+
+	std::vector<Sdl::RenderData> sprites(3);
+	for (size_t i = 0; i < sprites.size(); i++) {
+		sprites[i].dstrect = SDL_Rect{static_cast<int>(i) * 60, 0, 50, 50};
+		sprites[i].col_or_tex = atlas_ids[i];
+	}
+	sprites[1].srcrect = SDL_Rect{0, 0, 4, 4};
+	sdl.draw(sprites);
+	CTEST(dbg_msg == "Batch rendered.");
+
+	auto font = sdl.load_font("../MononokiNerdFont-Regular.ttf", 24);
+	CTEST(dbg_msg == "Font loaded.");
+
+	SDL_Rect fps_rect = sdl.draw_text("FPS: 60", {10, 10}, {255, 255, 255, 255}, font);
+	CTEST(dbg_msg == "Batch rendered.");
+	CTEST(fps_rect.x == 10 && fps_rect.w > 0 && fps_rect.h > 0);
+
+	SDL_Rect measured = sdl.measure_text("FPS: 60", {10, 10}, font);
+	CTEST(measured.w == fps_rect.w && measured.h == fps_rect.h);
+
+	SDL_Rect two_lines = sdl.measure_text("FPS: 60\nFPS: 61", {10, 10}, font);
+	CTEST(two_lines.h > fps_rect.h);
+
+	CTEST(sdl.load_font("../MononokiNerdFont-Regular.ttf", 24) == font);
+	CTEST(dbg_msg == "Font was loaded earlier.");
+
+	sdl.load_text("cached font", {100, 100, 100, 255}, {0, 0}, "../MononokiNerdFont-Regular.ttf", 24);
+	CTEST(dbg_msg == "Text loaded.");
+
+	sdl.evict_font(font);
+	CTEST(dbg_msg == "Font evicted.");
+	auto reloaded = sdl.load_font("../MononokiNerdFont-Regular.ttf", 24);
+	CTEST(dbg_msg == "Font loaded.");
+	CTEST(reloaded != font);
+	font = reloaded;
+
+	sdl.unload_texture(atlas_ids[0]);
+	auto async_face = sdl.load_texture_async("../assets/face.bmp");
+	CTEST(dbg_msg == "Texture load queued.");
+	CTEST(sdl.texture_status(async_face) == Sdl::LoadStatus::Loading);
 
+	data.col_or_tex = async_face;
 	sdl.draw(data);
 	CTEST(dbg_msg == "Texture rendered.");
 
+	CTEST(sdl.wait_for_texture(async_face) == Sdl::LoadStatus::Ready);
+	CTEST(dbg_msg == "Async texture loaded.");
+	CTEST(sdl.load_texture("../assets/face.bmp") == async_face);
+
+	auto missing = sdl.load_texture_async("../assets/missing.bmp");
+	CTEST(sdl.wait_for_texture(missing) == Sdl::LoadStatus::Failed);
+
+	auto& frame = sdl.command_buffer();
+	frame.draw(data);
+	frame.draw(&sprites[1], 2);
+	frame.draw_text("Score: 100", {0, 0}, {255, 255, 255, 255}, font);
+	CTEST(frame.size() == 4);
+
+	sdl.present();
+	CTEST(dbg_msg == "Command buffer submitted.");
+	CTEST(frame.empty());
+
+	frame.set_sorting(true);
+	for (int i = 0; i < 100; i++) {
+		Sdl::RenderData item = sprites[1 + i % 2];
+		item.layer = static_cast<Uint16>(i % 3);
+		frame.draw(item);
+	}
+	frame.draw_text("Layer 1", {0, 0}, {255, 255, 255, 255}, font, 1);
+	sdl.present();
+	CTEST(dbg_msg == "Command buffer submitted.");
+	CTEST(frame.empty());
+
+	const auto& stats = sdl.stats();
+	CTEST(stats.quads >= 100);
+	CTEST(stats.draw_calls > 0 && stats.draw_calls < stats.quads);
+	CTEST(stats.draw_ms >= 0.0 && stats.present_ms >= 0.0);
+
+	for (int i = 0; i < 3; i++) {
+		frame.draw_text("Mixed", {0, 0}, {255, 255, 255, 255}, font);
+		frame.draw(sprites[1]);
+		Sdl::RenderData fill;
+		fill.dstrect = SDL_Rect{0, 0, 5, 5};
+		frame.draw(fill);
+	}
+	sdl.present();
+	CTEST(sdl.stats().draw_calls == 3);
+
+	auto background = sdl.create_layer(800, 600);
+	CTEST(dbg_msg == "Layer created.");
+	CTEST(sdl.begin_layer(background));
+	sdl.draw(&sprites[1], 2);
+	sdl.end_layer();
+	CTEST(dbg_msg == "Layer finished.");
+	CTEST(!sdl.begin_layer(background));
+	CTEST(dbg_msg == "Layer is up to date.");
+
+	sdl.mark_layer_dirty(background);
+	CTEST(sdl.begin_layer(background));
+	sdl.end_layer();
+
+	data.col_or_tex = background;
+	data.dstrect = std::nullopt;
+	sdl.draw(data);
+	CTEST(dbg_msg == "Texture rendered.");
+
+	sdl.set_partial_redraw(true);
+	sdl.clear({0, 0, 0, 255});
+	frame.draw(&sprites[1], 2);
+	sdl.present();
+	CTEST(dbg_msg == "Partial redraw presented.");
+	frame.draw(&sprites[1], 2);
+	sdl.present();
+	CTEST(dbg_msg == "Present skipped.");
+	Sdl::RenderData moved = sprites[2];
+	moved.dstrect->x += 10;
+	frame.draw(sprites[1]);
+	frame.draw(moved);
+	sdl.present();
+	CTEST(dbg_msg == "Partial redraw presented.");
+	frame.draw(sprites[1]);
+	frame.draw(moved);
+	sdl.invalidate({0, 0, 10, 10});
+	sdl.present();
+	CTEST(dbg_msg == "Partial redraw presented.");
+	frame.draw(sprites[1]);
+	frame.draw(moved);
+	sdl.present();
+	CTEST(dbg_msg == "Present skipped.");
+	moved.layer = 1;
+	frame.draw(sprites[1]);
+	frame.draw(moved);
+	sdl.present();
+	CTEST(dbg_msg == "Partial redraw presented.");
+	frame.set_sorting(false);
+	frame.draw(sprites[1]);
+	frame.draw(moved);
+	sdl.present();
+	CTEST(dbg_msg == "Partial redraw presented.");
+	frame.set_sorting(true);
+	sdl.set_partial_redraw(false);
+
+	auto video = sdl.create_streaming_texture(4, 2);
+	CTEST(dbg_msg == "Streaming texture created.");
+	auto locked = sdl.lock_texture(video);
+	CTEST(locked.pixels && locked.pitch >= 16 && locked.w == 4 && locked.h == 2);
+	sdl.unlock_texture(video);
+	CTEST(dbg_msg == "Texture updated.");
+
+	Sdl::PixelStream stream(4, 2);
+	CTEST(!sdl.update_texture(video, stream));
+	std::fill(stream.pixels(), stream.pixels() + stream.pitch() * 2, Uint8{255});
+	stream.publish();
+	CTEST(sdl.update_texture(video, stream));
+	CTEST(dbg_msg == "Texture updated.");
+	CTEST(!sdl.update_texture(video, stream));
+
+	Sdl::PixelStream region_stream(16, 16);
+	region_stream.publish();
+	bool region_stream_rejected = false;
+	try {
+		sdl.update_texture(atlas_ids[1], region_stream);
+	} catch (const std::runtime_error&) {
+		region_stream_rejected = true;
+	}
+	CTEST(region_stream_rejected);
+	auto video16 = sdl.create_streaming_texture(16, 16);
+	CTEST(sdl.update_texture(video16, region_stream));
+	sdl.unload_texture(video16);
+
+	auto yuv = sdl.create_streaming_texture(4, 2, SDL_PIXELFORMAT_IYUV);
+	std::vector<Uint8> planes(4 * 2 + 2 * (2 * 1), 128);
+	sdl.update_texture(yuv, planes.data(), 4);
+	CTEST(dbg_msg == "Texture updated.");
+	sdl.unload_texture(yuv);
+
+	bool static_lock_rejected = false;
+	try {
+		sdl.lock_texture(background);
+	} catch (const std::runtime_error&) {
+		static_lock_rejected = true;
+	}
+	CTEST(static_lock_rejected);
+
+	Sdl::write_asset_pack("test.pack", {"../assets/face2.bmp", "../assets/face3.bmp"});
+	CTEST(dbg_msg == "Asset pack written.");
+	sdl.unload_texture(atlas_ids[2]);
+	auto packed = sdl.load_asset_pack("test.pack");
+	CTEST(dbg_msg == "Asset pack loaded.");
+	CTEST(packed.size() == 2 && packed[0] == atlas_ids[1]);
+	CTEST(sdl.find_texture("../assets/face3.bmp") == packed[1]);
+	data.col_or_tex = packed[1];
+	sdl.draw(data);
+	CTEST(dbg_msg == "Texture rendered.");
+
+	bool invalid_pack_rejected = false;
+	try {
+		sdl.load_asset_pack("../assets/face.bmp");
+	} catch (const std::runtime_error&) {
+		invalid_pack_rejected = true;
+	}
+	CTEST(invalid_pack_rejected);
+
+	sdl.present();
+	size_t resident = sdl.texture_memory();
+	sdl.set_texture_budget(1);
+	CTEST(dbg_msg == "Texture evicted.");
+	size_t trimmed = sdl.texture_memory();
+	CTEST(trimmed < resident);
+	CTEST(sdl.texture_status(async_face) == Sdl::LoadStatus::Ready);
+	data.col_or_tex = async_face;
+	sdl.draw(data);
+	CTEST(dbg_msg == "Texture rendered.");
+	CTEST(sdl.texture_memory() > trimmed);
+	sdl.pin_texture(async_face);
+	sdl.present();
+	sdl.set_texture_budget(1);
+	CTEST(sdl.texture_memory() > trimmed);
+	sdl.pin_texture(async_face, false);
+	CTEST(sdl.texture_memory() == trimmed);
+	bool evicted_lock_rejected = false;
+	try {
+		sdl.lock_texture(async_face);
+	} catch (const std::runtime_error&) {
+		evicted_lock_rejected = true;
+	}
+	CTEST(evicted_lock_rejected);
+	std::vector<Uint8> face_pixels(16 * 16 * 4, 255);
+	sdl.update_texture(async_face, face_pixels.data(), 16 * 4);
+	CTEST(dbg_msg == "Texture updated.");
+	CTEST(sdl.texture_memory() > trimmed);
+	sdl.set_texture_budget(0);
+
+	CTEST(SDL_BITSPERPIXEL(sdl.preferred_texture_format()) == 32);
+	CTEST(SDL_ISPIXELFORMAT_ALPHA(sdl.preferred_texture_format()));
+
+	CTEST(sdl.framebuffer() == nullptr);
+
+	Sdl::Instances particles;
+	for (int i = 0; i < 100; i++)
+		particles.push({static_cast<float>(i), 10.0f}, {4.0f, 4.0f});
+	CTEST(particles.size() == 100 && particles.angle.empty() && particles.color.empty());
+	particles.push({0.0f, 0.0f}, {4.0f, 4.0f}, 30.0f, {255, 0, 0, 128});
+	CTEST(particles.angle.size() == 101 && particles.color.size() == 101);
+	sdl.draw_instanced(async_face, particles);
+	CTEST(dbg_msg == "Instances rendered.");
+	particles.w.pop_back();
+	bool mismatch_rejected = false;
+	try {
+		sdl.draw_instanced(async_face, particles);
+	} catch (const std::runtime_error&) {
+		mismatch_rejected = true;
+	}
+	CTEST(mismatch_rejected);
+
+	Sdl::FrameQueue queue;
+	CTEST(queue.acquire().empty());
+	queue.back().draw(sprites[1]);
+	queue.publish();
+	CTEST(queue.back().empty());
+	CTEST(queue.acquire().size() == 1);
+	CTEST(queue.acquire().size() == 1);
+	sdl.submit(queue);
+	CTEST(dbg_msg == "Command buffer submitted.");
+
+	std::thread producer([&]() {
+		for (size_t frame = 1; frame <= 200; frame++) {
+			for (size_t i = 0; i < frame; i++)
+				queue.back().draw(sprites[1]);
+			queue.publish();
+		}
+	});
+	size_t newest = 0;
+	bool in_order = true;
+	while (newest < 200) {
+		size_t size = queue.acquire().size();
+		in_order = in_order && size >= newest;
+		newest = size;
+	}
+	producer.join();
+	CTEST(in_order);
+
+	sdl.present();
+	Sdl::FrameQueue sorted_queue;
+	sorted_queue.back().set_sorting(true);
+	bool batched = true;
+	for (int frame = 0; frame < 4; frame++) {
+		for (int i = 0; i < 3; i++) {
+			sorted_queue.back().draw(sprites[1]);
+			Sdl::RenderData fill;
+			fill.dstrect = SDL_Rect{0, 0, 5, 5};
+			sorted_queue.back().draw(fill);
+		}
+		sorted_queue.publish();
+		sdl.submit(sorted_queue);
+		sdl.present();
+		batched = batched && sdl.stats().draw_calls == 2;
+	}
+	CTEST(batched);
+
+	Sdl::RenderData other = sprites[1];
+	other.col_or_tex = async_face;
+	std::vector<Sdl::CommandBuffer> lists(3);
+	std::vector<std::thread> recorders;
+	for (auto& list : lists)
+		recorders.emplace_back([&]() {
+			for (int i = 0; i < 3000; i++)
+				list.draw(i < 2000 ? sprites[1] : other);
+		});
+	for (auto& recorder : recorders)
+		recorder.join();
+	lists[2].draw_text("merged", {0, 0}, {255, 255, 255, 255}, font);
+	sdl.submit({&lists[0], &lists[1], &lists[2]});
+	CTEST(dbg_msg == "Command lists submitted.");
+	sdl.present();
+	CTEST(sdl.stats().quads >= 9000);
+
+	sdl.set_culling(true);
+	Sdl::RenderData offscreen = sprites[1];
+	offscreen.dstrect = SDL_Rect{-100, -100, 10, 10};
+	sdl.draw(offscreen);
+	CTEST(dbg_msg == "Draw culled.");
+	Sdl::RenderData rotated = offscreen;
+	rotated.dstrect = SDL_Rect{-12, 0, 10, 10};
+	rotated.angle = 45.0f;
+	sdl.draw(rotated);
+	CTEST(dbg_msg == "Texture rendered.");
+	std::vector<Sdl::RenderData> scrolled(10, sprites[1]);
+	for (size_t i = 0; i < 6; i++)
+		scrolled[i] = offscreen;
+	sdl.draw(scrolled);
+	sdl.present();
+	CTEST(sdl.stats().culled == 7);
+	sdl.set_culling(false);
+
+	Sdl::StaticBatch tiles(100);
+	for (int y = 0; y < 20; y++)
+		for (int x = 0; x < 20; x++) {
+			Sdl::RenderData tile = sprites[1];
+			tile.dstrect = SDL_Rect{x * 100, y * 100, 100, 100};
+			tiles.add(tile);
+		}
+	CTEST(tiles.size() == 400);
+	sdl.draw(tiles, {450, 450, 800, 600});
+	CTEST(dbg_msg == "Static batch rendered.");
+	sdl.present();
+	CTEST(sdl.stats().quads >= 63 && sdl.stats().quads <= 80);
+	bool missing_dstrect_rejected = false;
+	try {
+		tiles.add(Sdl::RenderData{});
+	} catch (const std::runtime_error&) {
+		missing_dstrect_rejected = true;
+	}
+	CTEST(missing_dstrect_rejected);
+
+	sdl.set_camera({400.0f, 300.0f});
+	CTEST(sdl.transform().identity());
+	sdl.translate(100.0f, 50.0f);
+	sdl.push_transform();
+	sdl.rotate(90.0f);
+	SDL_FPoint turned = sdl.transform().apply({10.0f, 0.0f});
+	CTEST(std::fabs(turned.x - 100.0f) < 1e-3f && std::fabs(turned.y - 60.0f) < 1e-3f);
+	sdl.pop_transform();
+	Sdl::RenderData subpixel = sprites[1];
+	subpixel.fdstrect = SDL_FRect{0.5f, 0.5f, 10.0f, 10.0f};
+	sdl.draw(subpixel);
+	CTEST(dbg_msg == "Batch rendered.");
+	sdl.set_culling(true);
+	sdl.translate(-1000.0f, 0.0f);
+	sdl.draw(subpixel);
+	CTEST(dbg_msg == "Draw culled.");
+	sdl.set_culling(false);
+	sdl.set_transform({});
+	bool empty_stack_rejected = false;
+	try {
+		sdl.pop_transform();
+	} catch (const std::runtime_error&) {
+		empty_stack_rejected = true;
+	}
+	CTEST(empty_stack_rejected);
+
+	CTEST(sdl.try_clear({0, 0, 0, 255}) == Sdl::Error::None);
+	CTEST(sdl.try_set_draw_color({255, 255, 255, 255}) == Sdl::Error::None);
+	CTEST(sdl.try_draw(sprites[1]) == Sdl::Error::None);
+	CTEST(dbg_msg == "Texture rendered.");
+	Sdl::RenderData invalid = sprites[1];
+	invalid.col_or_tex = Sdl::TextureId{};
+	CTEST(sdl.try_draw(invalid) == Sdl::Error::InvalidHandle);
+	std::vector<Sdl::RenderData> mixed {sprites[1], invalid};
+	CTEST(sdl.try_draw(mixed) == Sdl::Error::InvalidHandle);
+	CTEST(dbg_msg == "Texture rendered.");
+	mixed.pop_back();
+	CTEST(sdl.try_draw(mixed) == Sdl::Error::None);
+	CTEST(dbg_msg == "Batch rendered.");
+
+	sdl.present();
+	Sdl::RenderData fill;
+	fill.dstrect = SDL_Rect{0, 0, 10, 10};
+	fill.col_or_tex = SDL_Color{1, 2, 3, 255};
+	sdl.draw(fill);
+	sdl.draw(fill);
+	fill.col_or_tex = SDL_Color{3, 2, 1, 255};
+	sdl.draw(fill);
+	sdl.set_blend_mode(SDL_BLENDMODE_BLEND);
+	sdl.set_blend_mode(SDL_BLENDMODE_BLEND);
+	sdl.set_texture_mod(std::get<Sdl::TextureId>(sprites[1].col_or_tex), {255, 0, 0, 128});
+	sdl.draw(sprites[1]);
+	sdl.draw(sprites[1]);
+	sdl.present();
+	CTEST(sdl.stats().state_changes == 5);
+	sdl.set_texture_mod(std::get<Sdl::TextureId>(sprites[1].col_or_tex), {255, 255, 255, 255});
+	sdl.set_blend_mode(SDL_BLENDMODE_NONE);
+
+	const auto overwrite = std::filesystem::copy_options::overwrite_existing;
+	std::filesystem::copy_file("../assets/face.bmp", "hot_reload.bmp", overwrite);
+	sdl.set_hot_reload(true);
+	CTEST(dbg_msg == "Hot reload enabled.");
+	auto hot = sdl.load_texture("hot_reload.bmp");
+	std::filesystem::copy_file("../assets/face2.bmp", "hot_reload.bmp", overwrite);
+	bool hot_reloaded = false;
+	for (int i = 0; i < 200 && !hot_reloaded; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		sdl.present();
+		hot_reloaded = dbg_msg == "Texture hot reloaded.";
+	}
+	CTEST(hot_reloaded);
+	CTEST(sdl.find_texture("hot_reload.bmp") == hot);
+	// The same directory spelled differently.
+	std::filesystem::copy_file("../assets/face.bmp", "hot_reload2.bmp", overwrite);
+	auto hot2 = sdl.load_texture("./hot_reload2.bmp");
+	std::filesystem::copy_file("../assets/face2.bmp", "hot_reload2.bmp", overwrite);
+	hot_reloaded = false;
+	for (int i = 0; i < 200 && !hot_reloaded; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		sdl.present();
+		hot_reloaded = dbg_msg == "Texture hot reloaded.";
+	}
+	CTEST(hot_reloaded);
+	sdl.set_hot_reload(false);
+	sdl.unload_texture(hot);
+	sdl.unload_texture(hot2);
+	std::filesystem::remove("hot_reload.bmp");
+	std::filesystem::remove("hot_reload2.bmp");
+
+	sdl.set_frame_rate(100.0);
+	auto paced_start = std::chrono::steady_clock::now();
+	for (int i = 0; i < 5; i++)
+		sdl.present();
+	CTEST(std::chrono::steady_clock::now() - paced_start >= std::chrono::milliseconds(40));
+	CTEST(std::fabs(sdl.stats().frame_rate - 100.0) < 0.1);
+	sdl.set_frame_rate(1000.0, true);
+	for (int i = 0; i < 8; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(3));
+		sdl.present();
+	}
+	CTEST(sdl.stats().frame_rate <= 500.0);
+	sdl.mark_input();
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	sdl.present();
+	CTEST(sdl.stats().input_latency_ms >= 2.0);
+	sdl.set_frame_rate(0.0);
+
+	sdl.set_profiling(1024);
+	CTEST(dbg_msg == "Profiling enabled.");
+	sdl.load_text("profiled \"text\"", {100, 100, 100, 255}, {0, 0}, "../MononokiNerdFont-Regular.ttf", 24);
+	sdl.draw(std::vector<Sdl::RenderData>(3, sprites[1]));
+	sdl.present();
+	auto trace = sdl.profile_trace(1);
+	CTEST(trace.find("\"name\":\"load_text\"") != std::string::npos);
+	CTEST(trace.find("profiled \\\"text\\\"") != std::string::npos);
+	CTEST(trace.find("\"name\":\"flush_batch\"") != std::string::npos);
+	CTEST(trace.find("\"name\":\"present\"") != std::string::npos);
+	sdl.present();
+	CTEST(sdl.profile_trace(0).find("load_text") == std::string::npos);
+	sdl.save_profile_trace("profile.json", 2);
+	CTEST(dbg_msg == "Profile trace saved.");
+	sdl.set_profiling(0);
+	CTEST(sdl.profile_trace(1) == "{\"traceEvents\":[]}");
+
 	} catch (const std::runtime_error& e) {
 		std::cerr << e.what() << "\n";
 	}